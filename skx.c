@@ -1,22 +1,65 @@
-#define DEBUG
 #include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/hrtimer.h>
 #include <linux/input.h>
+#include <linux/idr.h>
+#include <linux/jump_label.h>
+#include <linux/kref.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
 #include <linux/rcupdate.h>
 #include <linux/slab.h>
 #include <linux/stat.h>
+#include <linux/string.h>
+#include <linux/miscdevice.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/poll.h>
+#include <linux/seq_file.h>
 #include <linux/usb/input.h>
 #include <linux/usb/quirks.h>
-/*#include <linux/workqueue.h>*/
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include "skx_proto.h"
+#include "skx_raw.h"
+
+#define CREATE_TRACE_POINTS
+#include "skx_trace.h"
 
 MODULE_AUTHOR("Noah Steinberg and Jeremy Kielbiski");
 MODULE_DESCRIPTION("A dedicated Xbox One Controller driver");
 MODULE_LICENSE("GPL");
 
-/*#define DELAY_FF_SPRING 1*/
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+static inline void hrtimer_setup(struct hrtimer *timer,
+    enum hrtimer_restart (*function)(struct hrtimer *),
+    clockid_t clock_id, enum hrtimer_mode mode)
+{
+  hrtimer_init(timer, clock_id, mode);
+  timer->function = function;
+}
+#endif
 
-#define PKT_LEN 64
-#define MAX_OUT_PACKETS 2
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+static inline void vm_flags_clear(struct vm_area_struct *vma, vm_flags_t flags)
+{
+  vma->vm_flags &= ~flags;
+}
+#endif
+
+#define MAX_IN_URBS 16
+#define SKX_HIST_BUCKETS 32
+#define SKX_HS_TIMEOUT_MS 500
+#define SKX_IN_DELAY_MAX_US 10000
+#define SKX_CAPTURE_SLOTS 4096
+#define SKX_HS_RETRIES 3
+#define SKX_ERR_BACKOFF_MS 4
+#define SKX_ERR_BACKOFF_MAX 8    /* doublings, 4 ms << 8 is about a second */
+#define SKX_ERR_RESET_AFTER 6
+#define SKX_ERR_QUIET_MS 5000
 #define DEV_NAME "Microsoft X-Box One Controller"
 #define SKX_PROTOCOL() \
   .match_flags = USB_DEVICE_ID_MATCH_VENDOR | USB_DEVICE_ID_MATCH_INT_INFO, \
@@ -25,20 +68,51 @@ MODULE_LICENSE("GPL");
   .bInterfaceSubClass = 71, \
   .bInterfaceProtocol = 208
 
-static u8 lT_level = 0x00;
-static int lT_overflow = 0;
-static u8 rT_level = 0x00;
-static int rT_overflow = 0;
+static unsigned int in_urbs = 4;
+module_param(in_urbs, uint, 0444);
+MODULE_PARM_DESC(in_urbs, "Number of interrupt-in URBs kept in flight per pad (1-16, default 4)");
 
-static u8 lSX_level = 0x00;
-static u8 rSX_level = 0x00;
-static u8 lSY_level = 0x00;
-static u8 rSY_level = 0x00;
+static unsigned int in_interval;
+module_param(in_interval, uint, 0444);
+MODULE_PARM_DESC(in_interval, "Override the IN endpoint bInterval, 0 keeps the pad's (default 0)");
 
-/*static int delay_queue[64];
+static unsigned int out_interval;
+module_param(out_interval, uint, 0444);
+MODULE_PARM_DESC(out_interval, "Override the OUT endpoint bInterval, 0 keeps the pad's (default 0)");
 
-static struct workqueue_struct *skx_workqueue;
-*/
+static DEFINE_STATIC_KEY_FALSE(skx_debug_reports);
+
+/* Held by every pad whose packet capture is on */
+static DEFINE_STATIC_KEY_FALSE(skx_capture_key);
+
+static int skx_set_debug_reports(const char *val, const struct kernel_param *kp)
+{
+  bool enable;
+  int err;
+
+  err = kstrtobool(val, &enable);
+  if (err)
+    return err;
+
+  if (enable)
+    static_branch_enable(&skx_debug_reports);
+  else
+    static_branch_disable(&skx_debug_reports);
+
+  return 0;
+}
+
+static int skx_get_debug_reports(char *buf, const struct kernel_param *kp)
+{
+  return sprintf(buf, "%c\n", static_key_enabled(&skx_debug_reports) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops skx_debug_reports_ops = {
+  .set = skx_set_debug_reports,
+  .get = skx_get_debug_reports,
+};
+module_param_cb(debug_reports, &skx_debug_reports_ops, NULL, 0644);
+MODULE_PARM_DESC(debug_reports, "Log every pressed button of every input report (default N)");
 
 static struct usb_device_id skx_table[] = {
   {SKX_PROTOCOL()},
@@ -47,10 +121,209 @@ static struct usb_device_id skx_table[] = {
 
 MODULE_DEVICE_TABLE(usb, skx_table);
 
-struct output_packet {
-  u8 data[PKT_LEN];
+/*
+  One slot of the interrupt-in ring. Every slot owns its own DMA buffer so
+  a URB can be handed back to the host controller while the previous
+  report is still being decoded.
+*/
+struct input_urb {
+  struct urb *urb;
+  unsigned char *data;
+  dma_addr_t data_dma;
+};
+
+enum skx_report_stat {
+  SKX_STAT_REPORT_OTHER,
+  SKX_STAT_REPORT_02,
+  SKX_STAT_REPORT_03,
+  SKX_STAT_REPORT_04,
+  SKX_STAT_REPORT_07,
+  SKX_STAT_REPORT_20,
+  SKX_STAT_REPORTS
+};
+
+struct skx_urb_status {
+  int status;
+  const char *name;
+};
+
+/* URB statuses counted on their own, anything else lands in "other" */
+static const struct skx_urb_status skx_urb_statuses[] = {
+  { -ECONNRESET, "ECONNRESET" },
+  { -ENOENT, "ENOENT" },
+  { -ESHUTDOWN, "ESHUTDOWN" },
+  { -EPROTO, "EPROTO" },
+  { -EILSEQ, "EILSEQ" },
+  { -ETIME, "ETIME" },
+  { -EPIPE, "EPIPE" },
+  { -EOVERFLOW, "EOVERFLOW" },
+  { -EREMOTEIO, "EREMOTEIO" },
+  { -ENODEV, "ENODEV" },
+};
+#define SKX_URB_STATUSES (ARRAY_SIZE(skx_urb_statuses) + 1)
+
+/*
+  Per-CPU counters, only ever bumped with this_cpu_inc() so the completion
+  handlers never share a cache line or take a lock for them. Everything is
+  a u64 so readers can sum the CPUs up as flat arrays. Latency histograms
+  are log2 of nanoseconds: bucket i counts [2^(i-1), 2^i) ns.
+*/
+struct skx_pcpu_stats {
+  u64 reports[SKX_STAT_REPORTS];
+  u64 in_urb_errors[SKX_URB_STATUSES];
+  u64 out_urb_errors[SKX_URB_STATUSES];
+  u64 gip_acks;
+  u64 gip_malformed;
+  u64 gip_chunk_errors;
+  u64 out_packets;
+  u64 out_dropped;
+  u64 ff_requests;
+  u64 ff_overwritten;
+  u64 urb_recoveries;
+  u64 urb_halts_cleared;
+  u64 urb_resets;
+  u64 sync_latency[SKX_HIST_BUCKETS];  /* input URB completion to input_sync() */
+  u64 ff_latency[SKX_HIST_BUCKETS];    /* FF event to its OUT URB completing */
+};
+
+#define skx_stat_inc(skx, field) this_cpu_inc((skx)->stats->field)
+
+/*
+  The haptic stream drives the motors around the FF engine: every frame
+  it plays makes what the engine last sent stale, and when it stops the
+  engine is kicked to take the motors back.
+*/
+enum {
+  SKX_FF_STALE,
+  SKX_FF_KICK
+};
+
+/*
+  URB error recovery. A completion that fails for any other reason than
+  its URB being killed or the pad going away is not resubmitted: it notes
+  what it saw in err_flags and leaves the rest to err_work, see
+  skx_recover(). Each round of recovery waits twice as long as the one
+  before, until no round was needed for SKX_ERR_QUIET_MS.
+*/
+enum {
+  SKX_ERR_IN_HALT,   /* -EPIPE on the IN endpoint */
+  SKX_ERR_OUT_HALT,  /* -EPIPE on the OUT endpoint */
+  SKX_ERR_BUS,       /* -EPROTO, -EILSEQ, -ETIME or -EPIPE since the last round */
+  SKX_ERR_RESET,     /* the pad was reset in this run of errors */
+  SKX_ERR_STOPPED    /* I/O is stopped on purpose, nothing to recover */
+};
+
+/*
+  /dev/skxraw<n>: every input report lands in a ring that readers mmap(),
+  and a second ring streams motor frames back out, see skx_raw.h.
+  Refcounted by the pad and by every open file, so the rings outlive the
+  pad for as long as someone still has them mapped.
+*/
+struct skx_raw {
+  struct kref ref;
+  struct miscdevice misc;
+  struct skx_raw_ring *ring;
+  wait_queue_head_t wait;
+  bool gone;
+  int id;
+  char name[16];
+
+  /* Haptic stream, tail and playing under the pad's output_data_lock */
+  struct skx_haptic_stream haptic;
+  wait_queue_head_t haptic_wait;
+
+  /* What write() kicks the stream through, NULL once the pad is gone */
+  struct mutex lock;
+  struct usb_skx *skx;
+};
+
+/* What the input completion reads the stick tables from, see skx_set_curve() */
+struct skx_curve_set {
+  struct rcu_head rcu;
+  struct skx_stick_curve sticks[SKX_STICKS];
+};
+
+struct skx_raw_client {
+  struct skx_raw *raw;
+  u32 seen;  /* head when poll() last reported POLLIN */
+};
+
+/*
+  One captured packet. seq is the record's number plus one, written last:
+  a reader that sees it change while copying the record drops it, as the
+  record was reused under it.
+*/
+struct skx_capture_rec {
+  u32 seq;
+  s32 status;
+  ktime_t ts;
+  u16 interval; /* urb->interval */
+  u8 ep;        /* endpoint address, USB_DIR_IN set for IN */
   u8 len;
-  bool is_pending;
+  u8 data[PKT_LEN];
+};
+
+/*
+  Ring of the last SKX_CAPTURE_SLOTS packets. Writers claim a record by
+  incrementing head, so the IN and OUT completions never take a lock;
+  start is head when capture was last switched on.
+*/
+struct skx_capture {
+  atomic_t head;
+  u32 start;
+  struct skx_capture_rec rec[SKX_CAPTURE_SLOTS];
+};
+
+/*
+  The record header of LINKTYPE_USB_LINUX_MMAPPED, the binary usbmon
+  header (struct mon_bin_hdr), in host byte order.
+*/
+struct skx_usbmon_hdr {
+  u64 id;
+  u8 type;         /* 'S'ubmission, 'C'ompletion or 'E'rror */
+  u8 xfer_type;    /* 1 for interrupt */
+  u8 epnum;
+  u8 devnum;
+  u16 busnum;
+  char flag_setup;
+  char flag_data;
+  s64 ts_sec;
+  s32 ts_usec;
+  s32 status;
+  u32 len_urb;
+  u32 len_cap;
+  u8 setup[8];
+  s32 interval;
+  s32 start_frame;
+  u32 xfer_flags;
+  u32 ndesc;
+};
+
+struct skx_pcap_file_hdr {
+  u32 magic;
+  u16 version_major;
+  u16 version_minor;
+  s32 thiszone;
+  u32 sigfigs;
+  u32 snaplen;
+  u32 linktype;
+};
+
+struct skx_pcap_rec_hdr {
+  u32 ts_sec;
+  u32 ts_nsec;
+  u32 incl_len;
+  u32 orig_len;
+};
+
+#define SKX_PCAP_MAGIC_NS 0xa1b23c4d
+#define SKX_PCAP_LINKTYPE_USB_LINUX_MMAPPED 220
+#define SKX_PCAP_REC_MAX (sizeof(struct skx_pcap_rec_hdr) + sizeof(struct skx_usbmon_hdr) + PKT_LEN)
+
+/* What a reader of capture.pcap gets, taken when it opened the file */
+struct skx_pcap_snapshot {
+  size_t len;
+  u8 data[];
 };
 
 struct usb_skx {
@@ -58,794 +331,2886 @@ struct usb_skx {
   struct usb_device *usb_dev;
   struct usb_interface *interface;
 
-  struct urb *interrupt_in;
-  unsigned char *input_data;
-  dma_addr_t input_data_dma;
+  struct skx_pcpu_stats __percpu *stats;
+  struct dentry *debugfs;
+  struct skx_raw *raw;
+
+  /*
+    Packet capture, switched through debugfs. The ring is allocated the
+    first time capture is switched on and kept until unbind, so it can
+    still be read once capture is off again.
+  */
+  struct mutex capture_lock;
+  struct skx_capture *capture;
+  bool capture_on;
+
+  /* Handshake state, under output_data_lock like out.hs_state */
+  unsigned int hs_tries;
+  ktime_t hs_start;              /* probe or resume */
+  unsigned int first_report_us;  /* hs_start to the first input report */
+  struct delayed_work hs_work;
+
+  /*
+    URB error recovery, the round count and time are only written by
+    err_work. err_lock makes checking SKX_ERR_STOPPED and queueing
+    err_work one step against skx_stop_recovery().
+  */
+  struct delayed_work err_work;
+  spinlock_t err_lock;
+  unsigned long err_flags;
+  unsigned int err_rounds;
+  ktime_t err_last;
+
+  struct input_urb in_ring[MAX_IN_URBS];
+  unsigned int num_in_urbs;
+  struct usb_anchor interrupt_in_anchor;
+  atomic_t in_urbs_active;
+  atomic_t in_ring_dry;
+  atomic_t in_resubmit_failed;
+
+  /*
+    Measured input rate, written only from the input completion handler.
+    in_jitter is 16 times the running mean deviation between consecutive
+    report gaps (RFC 3550 style), in ns.
+  */
+  ktime_t in_last;
+  s64 in_last_gap;
+  u64 in_jitter;
+  ktime_t in_window;
+  unsigned int in_window_reports;
+  unsigned int in_rate;
+
+  /*
+    How long a report takes from the wire to the completion of its URB,
+    taken off the completion time events are stamped with. Set from a
+    measurement (see tools/skx_gadget), 0 by default.
+  */
+  u32 in_delay_ns;
+
+  /* Serialises interval changes, the pad's own intervals are restored on unbind */
+  struct mutex interval_lock;
+  u8 in_interval_orig;
+  u8 out_interval_orig;
+
+  /*
+    Stick curves. The configuration is kept under curve_lock and compiled
+    into a new set on every change, which is swapped in with RCU; NULL
+    while both sticks are raw.
+  */
+  struct mutex curve_lock;
+  struct skx_stick_config stick_config[SKX_STICKS];
+  struct skx_curve_set __rcu *curves;
+
+  /* Chunked GIP message being reassembled, only touched by the input completion */
+  struct skx_gip_msg gip_msg;
+
+  /* Last 0x03 status of the pad, which it repeats as a heartbeat */
+  ktime_t gip_status_at;
+  u8 gip_status;
+
+  /* Previous 0x20 report (sticks shaped), the decoder only emits what differs from it */
+  u8 last_report[REPORT_LEN];
+
+  /*
+    Remap profile the decoder walks. Only changed with the input ring
+    stopped, together with dev, under interval_lock.
+  */
+  struct skx_keymap keymap;
 
   struct urb *interrupt_out;
   struct usb_anchor interrupt_out_anchor;
-  bool interrupt_out_active;
-  u8 data_serial;
   unsigned char *output_data;
   dma_addr_t output_data_dma;
   spinlock_t output_data_lock;
 
-  struct output_packet out_packets[MAX_OUT_PACKETS];
-  int last_out_packet;
+  struct skx_out out;  /* under output_data_lock, output_data is its buf */
+  ktime_t out_period;
+  unsigned int out_queue_hwm;
+
+  /* Force feedback engine, see skx_ff_update() */
+  spinlock_t ff_lock;
+  struct hrtimer ff_timer;
+  struct skx_ff_engine ff;
+  unsigned long ff_flags;  /* SKX_FF_STALE and SKX_FF_KICK, set from the OUT side */
 
   const char *name;
   char phys_path[64];
 };
 
-/*struct my_work
-{
-  struct work_struct wrk;
-  struct usb_skx *skx;
-};*/
-
-static const signed short skx_buttons[] = {
-  BTN_A, BTN_B, BTN_X, BTN_Y,
-  BTN_START, BTN_SELECT,
-  BTN_THUMBL, BTN_THUMBR,
-  BTN_TL, BTN_TR,
-  BTN_MODE,
-  -1
+/* Events of the pad's own layout, by the names remap profiles use for them */
+struct skx_code_name {
+  u16 type;
+  u16 code;
+  const char *name;
+};
+
+#define SKX_CODE(type, code) { type, code, #code }
+
+static const struct skx_code_name skx_code_names[] = {
+  SKX_CODE(EV_KEY, BTN_A),
+  SKX_CODE(EV_KEY, BTN_B),
+  SKX_CODE(EV_KEY, BTN_X),
+  SKX_CODE(EV_KEY, BTN_Y),
+  SKX_CODE(EV_KEY, BTN_START),
+  SKX_CODE(EV_KEY, BTN_SELECT),
+  SKX_CODE(EV_KEY, BTN_THUMBL),
+  SKX_CODE(EV_KEY, BTN_THUMBR),
+  SKX_CODE(EV_KEY, BTN_TL),
+  SKX_CODE(EV_KEY, BTN_TR),
+  SKX_CODE(EV_ABS, ABS_X),
+  SKX_CODE(EV_ABS, ABS_Y),
+  SKX_CODE(EV_ABS, ABS_RX),
+  SKX_CODE(EV_ABS, ABS_RY),
+  SKX_CODE(EV_ABS, ABS_HAT0X),
+  SKX_CODE(EV_ABS, ABS_HAT0Y),
+  SKX_CODE(EV_ABS, ABS_Z),
+  SKX_CODE(EV_ABS, ABS_RZ),
 };
-static const signed short skx_axis[] = {
-  ABS_X, ABS_Y,
-  ABS_RX, ABS_RY,
-  ABS_HAT0X, ABS_HAT0Y,
-  ABS_Z, ABS_RZ,
+static const signed short skx_ff_effects[] = {
+  FF_RUMBLE, FF_CONSTANT,
+  FF_PERIODIC, FF_SINE, FF_SQUARE, FF_TRIANGLE, FF_SAW_UP, FF_SAW_DOWN,
+  FF_SPRING, FF_DAMPER,
+  FF_GAIN,
   -1
 };
 
+struct skx_report_bit {
+  u8 offset;
+  u8 mask;
+  const char *name;
+};
+
+static const struct skx_report_bit skx_debug_bits[] = {
+  { 4, 0x01, "Wireless Connect Button" },
+  { 4, 0x02, "Xbox Button" },
+  { 4, 0x04, "Start Button" },
+  { 4, 0x08, "Select Button" },
+  { 4, 0x10, "A Button" },
+  { 4, 0x20, "B Button" },
+  { 4, 0x40, "X Button" },
+  { 4, 0x80, "Y Button" },
+  { 5, 0x01, "Up DPAD" },
+  { 5, 0x02, "Down DPAD" },
+  { 5, 0x04, "Left DPAD" },
+  { 5, 0x08, "Right DPAD" },
+  { 5, 0x10, "Left Bumper" },
+  { 5, 0x20, "Right Bumper" },
+  { 5, 0x40, "Left Stick" },
+  { 5, 0x80, "Right Stick" },
+};
+
 static int skx_probe(struct usb_interface *interface, const struct usb_device_id *id);
 static void skx_interrupt_in(struct urb *urb);
 static void skx_interrupt_out(struct urb *urb);
 static int skx_send_packet(struct usb_skx *skx);
-static bool skx_prepare_packet(struct usb_skx *skx);
+static int skx_out_submit(struct usb_skx *skx, unsigned int todo);
+static struct output_packet *skx_queue_packet(struct usb_skx *skx, enum skx_out_class cls);
 static void skx_disconnect(struct usb_interface *interface);
+static void skx_stop_output(struct usb_skx *skx);
 static int skx_init_output(struct usb_interface *interface, struct usb_skx *skx);
+static int skx_init_input_ring(struct usb_interface *interface, struct usb_skx *skx);
+static void skx_free_input_ring(struct usb_skx *skx);
+static int skx_submit_in_urb(struct usb_skx *skx, struct urb *urb, gfp_t mem_flags);
+static void skx_process_packet(struct usb_skx *skx, const struct skx_gip_header *hdr,
+    const u8 *data, ktime_t ts);
+static void skx_gip_chunk_in(struct usb_skx *skx, struct urb *urb,
+    const struct skx_gip_header *hdr, ktime_t ts);
+static void skx_gip_ack(struct usb_skx *skx, const struct skx_gip_header *hdr, u16 received,
+    u16 remaining);
+static void skx_decode_report(struct usb_skx *skx, const unsigned char *data);
+static void skx_debug_report(struct device *d, const unsigned char *data);
 static int skx_init_input(struct usb_skx *skx);
+static void skx_init_ff(struct usb_skx *skx);
 static int skx_start_input(struct usb_skx *skx);
-/*static void skx_delayed_action(struct work_struct*);*/
+static int skx_restart(struct usb_skx *skx);
+static void skx_urb_fault(struct usb_skx *skx, int status, int halt_bit);
+static void skx_init_debugfs(struct usb_skx *skx);
+static void skx_fill_in_urb(struct usb_skx *skx, struct input_urb *slot);
+static void skx_fill_out_urb(struct usb_skx *skx);
+static int skx_submit_in_ring(struct usb_skx *skx);
+static int skx_apply_intervals(struct usb_skx *skx, unsigned int in, unsigned int out);
+static int skx_init_raw(struct usb_skx *skx);
+static void skx_free_raw(struct usb_skx *skx);
+static void skx_free_output(struct usb_skx *skx);
+
+static DEFINE_IDA(skx_raw_ida);
+
+static struct dentry *skx_debugfs_root;
+
+static unsigned int skx_status_index(int status)
+{
+  unsigned int i;
+
+  for (i = 0; i < ARRAY_SIZE(skx_urb_statuses); i++)
+    if (skx_urb_statuses[i].status == status)
+      return i;
 
-int skx_play_ff(struct input_dev *dev, void* data, struct ff_effect *effect)
+  return ARRAY_SIZE(skx_urb_statuses);
+}
+
+static unsigned int skx_hist_bucket(ktime_t delta)
 {
-  int err, ltx, lty, rtx, rty;
-  __u16 s, w;
-  struct usb_skx *skx = input_get_drvdata(dev);
+  if (delta <= 0)
+    return 0;
+
+  return min_t(unsigned int, fls64(delta), SKX_HIST_BUCKETS - 1);
+}
+
+static ktime_t skx_interval_to_ktime(struct usb_device *usb_dev, int interval)
+{
+  /* High speed intervals are 2^(bInterval-1) microframes, full speed ones frames */
+  if (usb_dev->speed >= USB_SPEED_HIGH)
+    return ns_to_ktime((1ULL << (clamp(interval, 1, 16) - 1)) * 125 * NSEC_PER_USEC);
+
+  return ms_to_ktime(max(interval, 1));
+}
+
+static void skx_send_rumble(struct usb_skx *skx, const struct skx_rumble *r, ktime_t now)
+{
+  struct output_packet *packet;
   unsigned long flags;
-  struct output_packet *packet = &skx->out_packets[1];
-  /*int i;
-  struct my_work *second,*third,*fourth,*fifth,*sixth,*seventh,*eigth,*ninth,*tenth;
-  second = kzalloc(sizeof(struct my_work), GFP_KERNEL);
-  third = kzalloc(sizeof(struct my_work), GFP_KERNEL);
-  fourth = kzalloc(sizeof(struct my_work), GFP_KERNEL);
-  fifth = kzalloc(sizeof(struct my_work), GFP_KERNEL);
-  sixth = kzalloc(sizeof(struct my_work), GFP_KERNEL);
-  seventh = kzalloc(sizeof(struct my_work), GFP_KERNEL);
-  eigth = kzalloc(sizeof(struct my_work), GFP_KERNEL);
-  ninth = kzalloc(sizeof(struct my_work), GFP_KERNEL);
-  tenth = kzalloc(sizeof(struct my_work), GFP_KERNEL);
-  second->skx = skx;
-  third->skx = skx;
-  fourth->skx = skx;
-  fifth->skx = skx;
-  sixth->skx = skx;
-  seventh->skx = skx;
-  eigth->skx = skx;
-  ninth->skx = skx;
-  tenth->skx = skx;*/
+  int err;
+
   spin_lock_irqsave(&skx->output_data_lock, flags);
-  
-  switch (effect->type){
-    case FF_CONSTANT:
-      s = effect->u.constant.level;
-      w = effect->u.constant.level;
-      dev_dbg(&dev->dev, "SKX: received FF_CONSTANT rumble request s: %d, w: %d, l: %d\n", s, w, effect->replay.length);
-      packet->data[0] = 0x09;
-      packet->data[1] = 0x00;
-      packet->data[2] = skx->data_serial++;
-      packet->data[3] = 0x09;
-      packet->data[4] = 0x00;
-      packet->data[5] = 0x0F;
-      packet->data[6] = 0x00; // Left Trigger Strength MIN 00 MAX 0x64
-      packet->data[7] = 0x00; // Right Trigger Strength MIN 00 MAX 0x64
-      packet->data[8] = s; // Heavy Rumble Strength MIN 40 MAX 0x64, off 00
-      packet->data[9] = w; // Light Rumble Strength MIN 40 MAX 0x64, off 00
-      packet->data[10] = 0xFF; // Effect Length MIN 0x00 MAX FF
-      packet->data[11] = 0x00; // Break Length MIN 0x00 MAX FF
-      packet->data[12] = 0x00; // Number of additional effects  MIN 0x00 MAX FF
-      packet->len = 13;
-      break;
-    case FF_RUMBLE:
-      s = effect->u.rumble.strong_magnitude;
-      w = effect->u.rumble.weak_magnitude;
-      if(s> 0xFF)
-        s=0xFF;
-      if(w> 0xFF)
-        w=0xFF;
-      dev_dbg(&dev->dev, "SKX: received FF_RUMBLE request s: %d, w: %d, l: %d\n", s, w, effect->replay.length);
-      packet->data[0] = 0x09;
-      packet->data[1] = 0x00;
-      packet->data[2] = skx->data_serial++;
-      packet->data[3] = 0x09;
-      packet->data[4] = 0x00;
-      packet->data[5] = 0x0F;
-      packet->data[6] = 0x00; // Left Trigger Strength MIN 00 MAX 0x64
-      packet->data[7] = 0x00; // Right Trigger Strength MIN 00 MAX 0x64
-      packet->data[8] = s; // Heavy Rumble Strength MIN 40 MAX 0x64, off 00
-      packet->data[9] = w; // Light Rumble Strength MIN 40 MAX 0x64, off 00
-      packet->data[10] = 0xFF; // Effect Length MIN 0x00 MAX FF
-      packet->data[11] = 0x00; // Break Length MIN 0x00 MAX FF
-      packet->data[12] = 0x00; // Number of additional effects  MIN 0x00 MAX FF
-      packet->len = 13;
-      break;
-    case FF_SPRING:
-      s = lT_overflow * 25 + lT_level / 0xA;
-      w = rT_overflow * 25 + rT_level / 0xA;
-      dev_dbg(&dev->dev, "SKX: received FF_SPRING request lT: %d rT: %d l: %d(L_Over: %d,L_Level: %d,R_Over: %d,R_Level: %d\n)", s, w, effect->replay.length, lT_overflow, lT_level, rT_overflow, rT_level);
-      packet->data[0] = 0x09;
-      packet->data[1] = 0x00;
-      packet->data[2] = skx->data_serial++;
-      packet->data[3] = 0x09;
-      packet->data[4] = 0x00;
-      packet->data[5] = 0x0F;
-      packet->data[6] = s; // Left Trigger Strength MIN 00 MAX 0x64
-      packet->data[7] = w; // Right Trigger Strength MIN 00 MAX 0x64
-      packet->data[8] = 0x00; // Heavy Rumble Strength MIN 40 MAX 0x64, off 00
-      packet->data[9] = 0x00; // Light Rumble Strength MIN 40 MAX 0x64, off 00
-      packet->data[10] = 0x90; // Effect Length MIN 0x00 MAX FF
-      packet->data[11] = 0x00; // Break Length MIN 0x00 MAX FF
-      packet->data[12] = 0x00; // Number of additional effects  MIN 0x00 MAX FF
-      packet->len = 13;
-      /*INIT_WORK(&second->wrk, skx_delayed_action);
-      INIT_WORK(&third->wrk, skx_delayed_action);
-      INIT_WORK(&fourth->wrk, skx_delayed_action);
-      INIT_WORK(&fifth->wrk, skx_delayed_action);
-      INIT_WORK(&sixth->wrk, skx_delayed_action);
-      INIT_WORK(&seventh->wrk, skx_delayed_action);
-      INIT_WORK(&eigth->wrk, skx_delayed_action);
-      INIT_WORK(&ninth->wrk, skx_delayed_action);
-      INIT_WORK(&tenth->wrk, skx_delayed_action);
-      for (i = 0; i < 9; i++)   
-        delay_queue[i]=DELAY_FF_SPRING;
-      queue_delayed_work(skx_workqueue, to_delayed_work(&second->wrk), 0x10);
-      queue_delayed_work(skx_workqueue, to_delayed_work(&third->wrk), 0x20);
-      queue_delayed_work(skx_workqueue, to_delayed_work(&fourth->wrk), 0x30);
-      queue_delayed_work(skx_workqueue, to_delayed_work(&fifth->wrk), 0x40);
-      queue_delayed_work(skx_workqueue, to_delayed_work(&sixth->wrk), 0x50);
-      queue_delayed_work(skx_workqueue, to_delayed_work(&seventh->wrk), 0x60);
-      queue_delayed_work(skx_workqueue, to_delayed_work(&eigth->wrk), 0x70);
-      queue_delayed_work(skx_workqueue, to_delayed_work(&ninth->wrk), 0x80);
-      queue_delayed_work(skx_workqueue, to_delayed_work(&tenth->wrk), 0x90);*/
-      break;
-    case FF_DAMPER:
-
-      if(lSX_level > 128)
-        ltx = -1 * (lSX_level - 255);
-      else
-        ltx = lSX_level;
-      if(lSY_level > 128)
-        lty = -1 * (lSY_level - 255);
-      else
-        lty = lSY_level;
-
-      if(rSX_level > 128)
-        rtx = -1 * (rSX_level - 255);
-      else
-        rtx = rSX_level;
-      if(rSY_level > 128)
-        rty = -1 * (rSY_level - 255);
-      else
-        rty = rSY_level;
-
-      if((rtx+rty) > (ltx+lty))
-        s = rtx+rty/3;
-      else
-        s = ltx+lty/3;
-
-      dev_dbg(&dev->dev, "SKX: received FF_DAMPER request s: %d l: %d (LSX: %d, LSY: %d, RSX: %d, RSY: %d)", s, effect->replay.length, ltx, lty, rtx, rty);
-      packet->data[0] = 0x09;
-      packet->data[1] = 0x00;
-      packet->data[2] = skx->data_serial++;
-      packet->data[3] = 0x09;
-      packet->data[4] = 0x00;
-      packet->data[5] = 0x0F;
-      packet->data[6] = 0x00; // Left Trigger Strength MIN 00 MAX FF
-      packet->data[7] = 0x00; // Right Trigger Strength MIN 00 MAX FF
-      packet->data[8] = s; // Heavy Rumble Strength MIN 40 MAX 0x64, off 00
-      packet->data[9] = s; // Light Rumble Strength MIN 40 MAX 0x64, off 00
-      packet->data[10] = 0x50; // Effect Length MIN 0x00 MAX FF
-      packet->data[11] = 0x00; // Break Length MIN 0x00 MAX FF
-      packet->data[12] = 0x00; // Number of additional effects  MIN 0x00 MAX FF
-      packet->len = 13;
-      break;
-    default:
-      dev_dbg(&dev->dev, "SKX: received unknown FF request\n");
-      packet->data[0] = 0x09;
-      packet->data[1] = 0x00;
-      packet->data[2] = skx->data_serial++;
-      packet->data[3] = 0x09;
-      packet->data[4] = 0x00;
-      packet->data[5] = 0x0F;
-      packet->data[6] = 0x00; // Left Trigger Strength MIN 00 MAX FF
-      packet->data[7] = 0x00; // Right Trigger Strength MIN 00 MAX FF
-      packet->data[8] = 0x00; // Heavy Rumble Strength MIN 40 MAX FF, off 00
-      packet->data[9] = 0x00; // Light Rumble Strength MIN 40 MAX FF, off 00
-      packet->data[10] = 0x50; // Effect Length MIN 0x00 MAX FF
-      packet->data[11] = 0x00; // Break Length MIN 0x00 MAX FF
-      packet->data[12] = 0x00; // Number of additional effects  MIN 0x00 MAX FF
-      packet->len = 13;
-
-  }
-
-
-  //memcpy(packet->data, buffer, packet->len);
-  packet->is_pending = true;
+
+  packet = skx_queue_packet(skx, SKX_OUT_FF);
+  packet->len = skx_build_rumble(packet->data, r);
+
+  /* A packet that replaces an unsent one keeps the older event's time */
+  if (!packet->stamp)
+    packet->stamp = now;
+
+  trace_skx_packet_queued(skx->usb_dev, SKX_OUT_FF, packet->data, packet->len,
+      skx->out.queues[SKX_OUT_FF].count);
 
   err = skx_send_packet(skx);
   if(err)
   {
-    dev_dbg(&dev->dev, "SKX: error sending FF packet %d \n", err);
+    dev_dbg(&skx->interface->dev, "SKX: error sending FF packet %d \n", err);
   }
 
   spin_unlock_irqrestore(&skx->output_data_lock, flags);
-
-  return 0;
 }
 
-/*static void skx_delayed_action(struct work_struct *work)
+/*
+  Renders the engine at now, sends a rumble packet if skx_ff_step() asks
+  for one and arms the timer for the next step. Called with ff_lock held.
+*/
+static void skx_ff_update(struct usb_skx *skx, ktime_t now)
 {
-  struct my_work *w = container_of(work, struct my_work, wrk);
-  struct usb_skx *skx = w->skx;
-  struct output_packet *packet = &skx->out_packets[1];
-  int i;
-  spin_lock_irqsave(&skx->output_data_lock, flags);
-  switch(delay_queue[0])
-  {
-    case(DELAY_FF_SPRING):
-      packet->data[0] = 0x09;
-      packet->data[1] = 0x00;
-      packet->data[2] = skx->data_serial++;
-      packet->data[3] = 0x09;
-      packet->data[4] = 0x00;
-      packet->data[5] = 0x0F;
-      packet->data[6] = lT_level; // Left Trigger Strength MIN 00 MAX FF
-      packet->data[7] = rT_level; // Right Trigger Strength MIN 00 MAX FF
-      packet->data[8] = 0x00; // Heavy Rumble Strength MIN 40 MAX FF, off 00
-      packet->data[9] = 0x00; // Light Rumble Strength MIN 40 MAX FF, off 00
-      packet->data[10] = 0x10; // Effect Length MIN 0x00 MAX FF
-      packet->data[11] = 0x00; // Break Length MIN 0x00 MAX FF
-      packet->data[12] = 0x00; // Number of additional effects  MIN 0x00 MAX FF
-      packet->len = 13;
-      packet->is_pending = true;
-      skx_send_packet(skx);
-      break;
+  struct skx_rumble r;
+  ktime_t next;
+
+  if (unlikely(READ_ONCE(skx->ff_flags))) {
+    clear_bit(SKX_FF_KICK, &skx->ff_flags);
+    if (test_and_clear_bit(SKX_FF_STALE, &skx->ff_flags))
+      skx_ff_invalidate(&skx->ff);
   }
-  spin_unlock_irqrestore(&skx->output_data_lock, flags);
-  for (i = 63; i > 1; i--){   
-      delay_queue[i]=delay_queue[i-1];
-    }
-  delay_queue[63] = 0;
-}*/
 
-static int skx_probe(struct usb_interface *interface, const struct usb_device_id *id)
-{
-  struct usb_device *usb_dev = interface_to_usbdev(interface);
-  struct usb_endpoint_descriptor *interrupt_in;
-  struct usb_skx *skx;
-  int err;
+  if (skx_ff_step(&skx->ff, now, &r, &next))
+    skx_send_rumble(skx, &r, now);
 
-  /*skx_workqueue = create_workqueue("skx_workqueue");*/
+  if (next != KTIME_MAX)
+    hrtimer_start(&skx->ff_timer, next, HRTIMER_MODE_ABS);
 
-  if(interface->cur_altsetting->desc.bNumEndpoints != 2)
-  {
-    return -ENODEV;
-  }
+  /* The stream may have stopped meanwhile, and its kick been pushed back by the start above */
+  if (unlikely(test_bit(SKX_FF_KICK, &skx->ff_flags)))
+    hrtimer_start(&skx->ff_timer, now, HRTIMER_MODE_ABS);
+}
 
-  skx = kzalloc(sizeof(struct usb_skx), GFP_KERNEL);
-  if(!skx)
-  {
-    return -ENOMEM;
-  }
+static enum hrtimer_restart skx_ff_timer(struct hrtimer *timer)
+{
+  struct usb_skx *skx = container_of(timer, struct usb_skx, ff_timer);
+  unsigned long flags;
 
-  usb_make_path(usb_dev, skx->phys_path, sizeof(skx->phys_path));
-  strlcat(skx->phys_path, "/input0", sizeof(skx->phys_path));
-  dev_dbg(&interface->dev, "Recieved Device Path: %s", skx->phys_path);
+  spin_lock_irqsave(&skx->ff_lock, flags);
+  skx_ff_update(skx, ktime_get());
+  spin_unlock_irqrestore(&skx->ff_lock, flags);
 
-  skx->input_data = usb_alloc_coherent(usb_dev, PKT_LEN, GFP_KERNEL,
-    &skx->input_data_dma);
-  if(!skx->input_data)
-  {
-    //Should free memory first!
-    return -ENOMEM;
-  }
+  return HRTIMER_NORESTART;
+}
 
-  skx->interrupt_in = usb_alloc_urb(0, GFP_KERNEL);
-  if(!skx->interrupt_in)
-  {
-    //Should free memory first!
-    return -ENOMEM;
-  }
+static int skx_ff_upload(struct input_dev *dev, struct ff_effect *effect, struct ff_effect *old)
+{
+  struct usb_skx *skx = input_get_drvdata(dev);
+  struct skx_ff_voice *v = &skx->ff.voices[effect->id];
+  unsigned long flags;
 
-  skx->interface=interface;
-  skx->usb_dev=usb_dev;
-  skx->name = "Microsoft X-Box One S pad";
+  spin_lock_irqsave(&skx->ff_lock, flags);
 
-  if (interface->cur_altsetting->desc.bInterfaceNumber != 0) {
-    //Should free memory first!
+  if (dev != skx->dev) {
+    spin_unlock_irqrestore(&skx->ff_lock, flags);
     return -ENODEV;
   }
 
-  err = skx_init_output(interface, skx);
-  if(err)
-  {
-    //Should free memory first!
-    return -ENOMEM;
-  }
-
-  interrupt_in = &interface->cur_altsetting->endpoint[1].desc;
+  v->effect = *effect;
+  skx_ff_compile(v);
 
-  usb_fill_int_urb(skx->interrupt_in, usb_dev,
-    usb_rcvintpipe(usb_dev, interrupt_in->bEndpointAddress),
-      skx->input_data, PKT_LEN, skx_interrupt_in,
-      skx, interrupt_in->bInterval);
-
-  usb_set_intfdata(interface, skx);
-
-  err = skx_init_input(skx);
-  if(err)
-  {
-    //Should free memory first!
-    return -ENOMEM;
-  }
-  err = skx_start_input(skx);
-  if(err)
-  {
-    //Should free memory first!
-    return -ENOMEM;
+  /* Updating a playing effect keeps its timing */
+  if (test_bit(effect->id, skx->ff.active)) {
+    if (skx_ff_is_condition(v))
+      skx_ff_condition(&skx->ff.pad, v, v->weights);
+    skx_ff_update(skx, ktime_get());
   }
 
-  input_set_capability(skx->dev, EV_FF, FF_RUMBLE);
-  input_set_capability(skx->dev, EV_FF, FF_CONSTANT);
-  input_set_capability(skx->dev, EV_FF, FF_SPRING);
-  input_set_capability(skx->dev, EV_FF, FF_DAMPER);
-  
-  err = input_ff_create_memless(skx->dev, NULL, skx_play_ff);
-  if (err){
-    return err;
-  }
+  spin_unlock_irqrestore(&skx->ff_lock, flags);
 
   return 0;
 }
 
-static void skx_interrupt_in(struct urb *urb)
+static int skx_ff_erase(struct input_dev *dev, int effect_id)
 {
-  struct usb_skx *skx = urb->context;
-  struct device *d = &skx->interface->dev;
-  int err;
-  unsigned char *data = skx->input_data;
-
-  //
-
-  err = urb->status;
+  struct usb_skx *skx = input_get_drvdata(dev);
+  unsigned long flags;
 
-  switch (err) {
-  case 0:
-    break;
-  case -ECONNRESET:
-  case -ENOENT:
-  case -ESHUTDOWN:
-    dev_dbg(d, "SKX: input urb error: %d\n",  err);
-    return;
-  default:
-    dev_dbg(d, "SKX: input unknown urb status: %d\n", err);
-    goto exit;
-  }
-
-  //Print this if we need to make sure something works
-  //print_hex_dump(KERN_DEBUG, "SKX IN: ", DUMP_PREFIX_OFFSET, 32, 1, skx->input_data, PKT_LEN, 0);
-
-    switch(data[0]) {
-      case 0x07:
-        if(data[1]==0x30){
-          unsigned long flags;
-          struct output_packet *packet =
-              &skx->out_packets[0];
-          static const u8 report_ack[] = {
-            0x01, 0x20, 0x00, 0x09, 0x00,
-            0x07, 0x20, 0x02, 0x00, 0x00,
-            0x00, 0x00, 0x00
-          };
-
-          spin_lock_irqsave(&skx->output_data_lock, flags);
-
-          packet->len = sizeof(report_ack);
-          memcpy(packet->data, report_ack, packet->len);
-          packet->data[2] = data[2];
-          packet->is_pending = true;
-
-          /* Reset the sequence so we send out the ack now */
-          skx->last_out_packet = -1;
-          skx_send_packet(skx);
-
-          spin_unlock_irqrestore(&skx->output_data_lock, flags);
-        }
-        input_report_key(skx->dev, BTN_MODE, data[4] & 0x01);
-        input_sync(skx->dev);
-        break;
-      case 0x20:
-        input_report_key(skx->dev, BTN_START,  data[4] & 0x04);
-        input_report_key(skx->dev, BTN_SELECT, data[4] & 0x08);
-
-        /* buttons A,B,X,Y */
-        input_report_key(skx->dev, BTN_A,  data[4] & 0x10);
-        input_report_key(skx->dev, BTN_B,  data[4] & 0x20);
-        input_report_key(skx->dev, BTN_X,  data[4] & 0x40);
-        input_report_key(skx->dev, BTN_Y,  data[4] & 0x80);
-
-        /* DPAD Axis */
-        input_report_abs(skx->dev, ABS_HAT0X,
-             !!(data[5] & 0x08) - !!(data[5] & 0x04));
-        input_report_abs(skx->dev, ABS_HAT0Y,
-             !!(data[5] & 0x02) - !!(data[5] & 0x01));
-
-        /* Stick Press Buttons */
-        input_report_key(skx->dev, BTN_THUMBL, data[5] & 0x40);
-        input_report_key(skx->dev, BTN_THUMBR, data[5] & 0x80);
-
-        /* Bumpers */
-        input_report_key(skx->dev, BTN_TL, data[5] & 0x10);
-        input_report_key(skx->dev, BTN_TR, data[5] & 0x20);
-
-        /* Triggers */
-        input_report_abs(skx->dev, ABS_Z,
-         (__u16) le16_to_cpup((__le16 *)(data + 6)));
-        lT_level = data[6];
-        lT_overflow = data[7];
-        input_report_abs(skx->dev, ABS_RZ,
-         (__u16) le16_to_cpup((__le16 *)(data + 8)));
-        rT_level = data[8];
-        rT_overflow = data[9];
-        /* Left Stick */
-        input_report_abs(skx->dev, ABS_X,
-             (__s16) le16_to_cpup((__le16 *)(data + 10)));
-        lSX_level = data[11];
-        input_report_abs(skx->dev, ABS_Y,
-             ~(__s16) le16_to_cpup((__le16 *)(data + 12)));
-        lSY_level = data[13];
-
-        /* Right Stick */
-        input_report_abs(skx->dev, ABS_RX,
-             (__s16) le16_to_cpup((__le16 *)(data + 14)));
-        rSX_level = data[15];
-        input_report_abs(skx->dev, ABS_RY,
-             ~(__s16) le16_to_cpup((__le16 *)(data + 16)));
-        rSY_level = data[17];
-        /*
-          All Finished
-        */
-
-        if(data[4] & 0x01)
-          dev_dbg(d, "Wireless Connect Button pressed.\n");
-        if(data[4] & 0x02)
-          dev_dbg(d, "Xbox Button pressed.\n");
-        if(data[4] & 0x04)
-          dev_dbg(d, "Start Button pressed.\n");
-        if(data[4] & 0x08)
-          dev_dbg(d, "Select Button pressed.\n");
-        if(data[4] & 0x10)
-          dev_dbg(d, "A Button pressed.\n");
-        if(data[4] & 0x20)
-          dev_dbg(d, "B Button pressed.\n");
-        if(data[4] & 0x40)
-          dev_dbg(d, "X Button pressed.\n");
-        if(data[4] & 0x80)
-          dev_dbg(d, "Y Button pressed.\n");
-
-        if(data[5] & 0x01)
-          dev_dbg(d, "Up DPAD pressed.\n");
-        if(data[5] & 0x02)
-          dev_dbg(d, "Down DPAD pressed.\n");
-        if(data[5] & 0x04)
-          dev_dbg(d, "Left DPAD pressed.\n");
-        if(data[5] & 0x08)
-          dev_dbg(d, "Right DPAD pressed.\n");
-        if(data[5] & 0x10)
-          dev_dbg(d, "Left Bumper pressed.\n");
-        if(data[5] & 0x20)
-          dev_dbg(d, "Right Bumper pressed.\n");
-        if(data[5] & 0x40)
-          dev_dbg(d, "Left Stick pressed.\n");
-        if(data[5] & 0x80)
-          dev_dbg(d, "Right Stick pressed.\n");
-
-        if (data[6] == 0xFF && data[7] == 3) 
-          dev_dbg(d, "Left Trigger pressed fully down.\n");
-        if (data[8] == 0xFF && data[9] == 3)
-          dev_dbg(d, "Right Trigger pressed fully down.\n");
-        if(data[11] >= 127 && data[11] < 130)
-          dev_dbg(d, "Left Stick pressed fully outwards on X axis.\n");
-        if(data[13] >= 127 && data[13] < 130)
-          dev_dbg(d, "Left Stick pressed fully outwards on Y axis.\n");
-        if(data[15] >= 127 && data[15] < 130)
-          dev_dbg(d, "Right Stick pressed fully outwards on X axis.\n");
-        if(data[17] >= 127 && data[17] < 130)
-          dev_dbg(d, "Right Stick pressed fully outwards on Y axis.\n");
-        input_sync(skx->dev);
-        break;
+  spin_lock_irqsave(&skx->ff_lock, flags);
 
-        input_sync(skx->dev);
-        break;
-    }
+  if (dev == skx->dev && __test_and_clear_bit(effect_id, skx->ff.active))
+    skx_ff_update(skx, ktime_get());
 
+  spin_unlock_irqrestore(&skx->ff_lock, flags);
 
-exit:
-  err = usb_submit_urb(urb, GFP_KERNEL);
-  if (err){
-    dev_err(d, "SKX: input usb_submit_urb failed: %d\n", err);
-  }
+  return 0;
 }
 
-static void skx_interrupt_out(struct urb *urb)
+static int skx_ff_playback(struct input_dev *dev, int effect_id, int value)
 {
-  struct usb_skx *skx = urb->context;
-  struct device *d = &skx->interface->dev;
-  int status = urb->status;
-  int err;
+  struct usb_skx *skx = input_get_drvdata(dev);
+  struct skx_ff_voice *v = &skx->ff.voices[effect_id];
   unsigned long flags;
 
-  spin_lock_irqsave(&skx->output_data_lock, flags);
+  trace_skx_ff_request(skx->usb_dev, effect_id, value, READ_ONCE(skx->out.serial));
+  skx_stat_inc(skx, ff_requests);
 
-  switch (status) {
-  case 0:
-    skx->interrupt_out_active = skx_prepare_packet(skx);
-    break;
+  spin_lock_irqsave(&skx->ff_lock, flags);
 
-  case -ECONNRESET:
-  case -ENOENT:
-  case -ESHUTDOWN:
-    dev_dbg(d, "SKX: output urb error: %d\n",  err);
-    skx->interrupt_out_active = false;
-    break;
+  if (dev != skx->dev) {
+    spin_unlock_irqrestore(&skx->ff_lock, flags);
+    return 0;
+  }
 
-  default:
-    dev_dbg(d, "SKX:output unknown urb status: %d\n", err);
-    break;
+  if (value > 0) {
+    v->start = ktime_get();
+    v->count = value;
+    if (skx_ff_is_condition(v))
+      skx_ff_condition(&skx->ff.pad, v, v->weights);
+    __set_bit(effect_id, skx->ff.active);
+  } else if (!__test_and_clear_bit(effect_id, skx->ff.active)) {
+    spin_unlock_irqrestore(&skx->ff_lock, flags);
+    return 0;
   }
 
-  //print_hex_dump(KERN_DEBUG, "SKX OUT: ", DUMP_PREFIX_OFFSET, 32, 1, skx->output_data, PKT_LEN, 0);
+  skx_ff_update(skx, ktime_get());
 
-  if (skx->interrupt_out_active) {
-    usb_anchor_urb(urb, &skx->interrupt_out_anchor);
-    err = usb_submit_urb(urb, GFP_KERNEL);
-    if (err) {
-      dev_err(d, "SKX: usb_submit_urb failed: %d\n", err);
-      usb_unanchor_urb(urb);
-      skx->interrupt_out_active = false;
-    }
-  }
+  spin_unlock_irqrestore(&skx->ff_lock, flags);
 
-  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+  return 0;
 }
 
-static int skx_send_packet(struct usb_skx *skx)
+static void skx_ff_set_gain(struct input_dev *dev, u16 gain)
 {
-  int err;
-
-  if (!skx->interrupt_out_active && skx_prepare_packet(skx)) {
-    usb_anchor_urb(skx->interrupt_out, &skx->interrupt_out_anchor);
-    err = usb_submit_urb(skx->interrupt_out, GFP_ATOMIC);
-    if (err) {
-      dev_err(&skx->interface->dev, "SKX: usb_submit_urb failed:%d\n", err);
-      usb_unanchor_urb(skx->interrupt_out);
-      return -EIO;
-    }
+  struct usb_skx *skx = input_get_drvdata(dev);
+  unsigned long flags;
 
-    skx->interrupt_out_active = true;
+  spin_lock_irqsave(&skx->ff_lock, flags);
+  if (dev == skx->dev) {
+    skx->ff.gain = gain;
+    skx_ff_update(skx, ktime_get());
   }
+  spin_unlock_irqrestore(&skx->ff_lock, flags);
+}
 
-  return 0;
+static void skx_init_ff(struct usb_skx *skx)
+{
+  spin_lock_init(&skx->ff_lock);
+  hrtimer_setup(&skx->ff_timer, skx_ff_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+  skx->ff.gain = 0xFFFF;
+  skx->ff.period = skx->out_period;
 }
 
-static bool skx_prepare_packet(struct usb_skx *skx)
+/*
+  Makes indev an FF device driven by the engine. Only skx->dev reaches
+  it: the callbacks of a device that was replaced (see skx_set_keymap())
+  are ignored until it is gone.
+*/
+static int skx_create_ff(struct input_dev *indev)
 {
-  struct output_packet *pkt, *packet = NULL;
-  int i;
+  struct ff_device *ff;
+  int i, err;
 
-  for (i = 0; i < MAX_OUT_PACKETS; i++) {
-    if (++skx->last_out_packet >= MAX_OUT_PACKETS)
-      skx->last_out_packet = 0;
+  for (i = 0; skx_ff_effects[i] >= 0; i++)
+    input_set_capability(indev, EV_FF, skx_ff_effects[i]);
 
-    pkt = &skx->out_packets[skx->last_out_packet];
-    if (pkt->is_pending) {
-      dev_dbg(&skx->interface->dev,"SKX: found pending output: %d\n", skx->last_out_packet);
-      packet = pkt;
-      break;
-    }
-  }
+  err = input_ff_create(indev, FF_EFFECTS);
+  if (err)
+    return err;
 
-  if (packet) {
-    memcpy(skx->output_data, packet->data, packet->len);
-    skx->interrupt_out->transfer_buffer_length = packet->len;
-    packet->is_pending = false;
-    return true;
-  }
+  ff = indev->ff;
+  ff->upload = skx_ff_upload;
+  ff->erase = skx_ff_erase;
+  ff->playback = skx_ff_playback;
+  ff->set_gain = skx_ff_set_gain;
 
-  return false;
+  return 0;
 }
 
-static void skx_disconnect(struct usb_interface *interface)
+/* Called with output_data_lock held */
+static void skx_queue_init_packet(struct usb_skx *skx, const u8 *data, u8 len)
 {
-  struct usb_skx *skx = usb_get_intfdata(interface);
-
-  usb_kill_urb(skx->interrupt_in);
+  struct output_packet *packet;
 
-  input_unregister_device(skx->dev);
+  packet = skx_queue_packet(skx, SKX_OUT_INIT);
+  if (!packet)
+    return;
 
-  if (!usb_wait_anchor_empty_timeout(&skx->interrupt_out_anchor, 5000)) {
-      usb_kill_anchored_urbs(&skx->interrupt_out_anchor);
-    }
+  memcpy(packet->data, data, len);
+  packet->len = len;
+  trace_skx_packet_queued(skx->usb_dev, SKX_OUT_INIT, packet->data, packet->len,
+      skx->out.queues[SKX_OUT_INIT].count);
+}
 
-  usb_free_urb(skx->interrupt_out);
-  usb_free_coherent(skx->usb_dev, PKT_LEN,
-      skx->output_data, skx->output_data_dma);
+/* First input report after power on, from the input completion */
+static void skx_hs_report(struct usb_skx *skx, ktime_t ts)
+{
+  unsigned long flags;
 
-  usb_free_urb(skx->interrupt_in);
-  usb_free_coherent(skx->usb_dev, PKT_LEN,
-      skx->input_data, skx->input_data_dma);
+  spin_lock_irqsave(&skx->output_data_lock, flags);
+  if (skx->out.hs_state == SKX_HS_WAIT) {
+    skx->out.hs_state = SKX_HS_READY;
+    WRITE_ONCE(skx->first_report_us, ktime_us_delta(ts, skx->hs_start));
+    cancel_delayed_work(&skx->hs_work);
+    dev_dbg(&skx->interface->dev, "SKX: first report after %u us, %u tries\n",
+        skx->first_report_us, skx->hs_tries + 1);
+  }
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+}
 
-  kfree(skx);
+static void skx_hs_timeout(struct work_struct *work)
+{
+  struct usb_skx *skx = container_of(to_delayed_work(work), struct usb_skx, hs_work);
+  unsigned long flags;
 
-  usb_set_intfdata(interface, NULL);
+  spin_lock_irqsave(&skx->output_data_lock, flags);
+  if (skx->out.hs_state == SKX_HS_WAIT) {
+    if (++skx->hs_tries < SKX_HS_RETRIES) {
+      dev_dbg(&skx->interface->dev, "SKX: no report after power on, sending it again\n");
+      skx_out_power_on(&skx->out);
+      skx_send_packet(skx);
+    } else {
+      dev_warn(&skx->interface->dev, "SKX: pad did not start reporting\n");
+    }
+  }
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
 }
-static int skx_init_output(struct usb_interface *interface, struct usb_skx *skx)
+
+/* Rounds of recovery so far in the current run of errors */
+static unsigned int skx_err_rounds(struct usb_skx *skx, ktime_t now)
 {
-  struct usb_endpoint_descriptor *interrupt_out;
+  if (ktime_ms_delta(now, READ_ONCE(skx->err_last)) > SKX_ERR_QUIET_MS)
+    return 0;
 
+  return READ_ONCE(skx->err_rounds);
+}
 
-  init_usb_anchor(&skx->interrupt_out_anchor);
+static void skx_schedule_recovery(struct usb_skx *skx, unsigned int rounds)
+{
+  unsigned int ms = SKX_ERR_BACKOFF_MS << min_t(unsigned int, rounds, SKX_ERR_BACKOFF_MAX);
+  unsigned long flags;
 
-  skx->output_data = usb_alloc_coherent(skx->usb_dev, PKT_LEN, GFP_KERNEL, &skx->output_data_dma);
-  if (!skx->output_data) {
-    return -ENOMEM;
-  }
+  spin_lock_irqsave(&skx->err_lock, flags);
+  if (!test_bit(SKX_ERR_STOPPED, &skx->err_flags))
+    schedule_delayed_work(&skx->err_work, msecs_to_jiffies(ms));
+  spin_unlock_irqrestore(&skx->err_lock, flags);
+}
+
+/*
+  Called from a completion that failed with status, after which its URB
+  stays idle until skx_recover() has run. However many URBs fail before
+  that, only one round is scheduled.
+*/
+static void skx_urb_fault(struct usb_skx *skx, int status, int halt_bit)
+{
+  switch (status) {
+  case -EPIPE:
+    set_bit(halt_bit, &skx->err_flags);
+    fallthrough;
+  case -EPROTO:
+  case -EILSEQ:
+  case -ETIME:
+    set_bit(SKX_ERR_BUS, &skx->err_flags);
+    break;
+  }
+
+  skx_schedule_recovery(skx, skx_err_rounds(skx, ktime_get()));
+}
+
+/*
+  Keeps err_work from restarting I/O that is being stopped on purpose,
+  until skx_resume() or the end of an interval change clears
+  SKX_ERR_STOPPED again. A completion failing after err_lock is dropped
+  finds the bit set, so once the cancel returns err_work stays idle
+  however late the URBs are killed. Called with interval_lock held, or
+  on the way out.
+*/
+static void skx_stop_recovery(struct usb_skx *skx)
+{
+  unsigned long flags;
+
+  spin_lock_irqsave(&skx->err_lock, flags);
+  set_bit(SKX_ERR_STOPPED, &skx->err_flags);
+  spin_unlock_irqrestore(&skx->err_lock, flags);
+
+  cancel_delayed_work_sync(&skx->err_work);
+}
+
+static void skx_clear_halt(struct usb_skx *skx, unsigned int pipe, const char *name)
+{
+  int err = usb_clear_halt(skx->usb_dev, pipe);
+
+  if (err)
+    dev_dbg(&skx->interface->dev, "SKX: could not clear the %s halt: %d\n", name, err);
+  else
+    skx_stat_inc(skx, urb_halts_cleared);
+}
+
+/*
+  One round of recovery: all URBs are stopped, halted endpoints cleared
+  and I/O restarted as after a resume, handshake included. Once rounds
+  keep being needed for transfer errors on the bus the pad is reset
+  instead, once per run of errors; the reset comes back through
+  skx_pre_reset() and skx_resume(), which replay the handshake too.
+*/
+static void skx_recover(struct work_struct *work)
+{
+  struct usb_skx *skx = container_of(to_delayed_work(work), struct usb_skx, err_work);
+  struct device *d = &skx->interface->dev;
+  ktime_t now = ktime_get();
+  unsigned long flags;
+  unsigned int rounds;
+  bool bus;
+  int err;
+
+  /* Whoever holds it stops recovery, and waits for this work while doing so */
+  if (!mutex_trylock(&skx->interval_lock)) {
+    skx_schedule_recovery(skx, 0);
+    return;
+  }
+
+  if (test_bit(SKX_ERR_STOPPED, &skx->err_flags))
+    goto out;
+
+  rounds = skx_err_rounds(skx, now);
+  if (!rounds)
+    clear_bit(SKX_ERR_RESET, &skx->err_flags);
+  WRITE_ONCE(skx->err_rounds, rounds + 1);
+  WRITE_ONCE(skx->err_last, now);
+
+  bus = test_and_clear_bit(SKX_ERR_BUS, &skx->err_flags);
+  if (bus && rounds >= SKX_ERR_RESET_AFTER &&
+      !test_and_set_bit(SKX_ERR_RESET, &skx->err_flags)) {
+    dev_warn(d, "SKX: URBs still failing after %u retries, resetting the pad\n", rounds);
+    skx_stat_inc(skx, urb_resets);
+    usb_queue_reset_device(skx->interface);
+    goto out;
+  }
+
+  dev_dbg(d, "SKX: restarting I/O, round %u\n", rounds + 1);
+
+  spin_lock_irqsave(&skx->output_data_lock, flags);
+  skx->out.paused = true;
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+
+  usb_kill_anchored_urbs(&skx->interrupt_in_anchor);
+  usb_kill_anchored_urbs(&skx->interrupt_out_anchor);
+  cancel_delayed_work_sync(&skx->hs_work);
+
+  if (test_and_clear_bit(SKX_ERR_IN_HALT, &skx->err_flags))
+    skx_clear_halt(skx, skx->in_ring[0].urb->pipe, "input");
+  if (test_and_clear_bit(SKX_ERR_OUT_HALT, &skx->err_flags))
+    skx_clear_halt(skx, skx->interrupt_out->pipe, "output");
+
+  skx_stat_inc(skx, urb_recoveries);
+  err = skx_restart(skx);
+  if (err) {
+    dev_dbg(d, "SKX: restart failed: %d\n", err);
+    skx_schedule_recovery(skx, rounds + 1);
+  }
+
+out:
+  mutex_unlock(&skx->interval_lock);
+}
+
+static int skx_probe(struct usb_interface *interface, const struct usb_device_id *id)
+{
+  struct usb_device *usb_dev = interface_to_usbdev(interface);
+  struct usb_host_interface *alt = interface->cur_altsetting;
+  struct usb_skx *skx;
+  int err;
+
+  if (alt->desc.bNumEndpoints != 2 || alt->desc.bInterfaceNumber != 0)
+    return -ENODEV;
+
+  skx = kzalloc(sizeof(struct usb_skx), GFP_KERNEL);
+  if (!skx)
+    return -ENOMEM;
+
+  skx->hs_start = ktime_get();
+
+  skx->stats = alloc_percpu(struct skx_pcpu_stats);
+  if (!skx->stats) {
+    err = -ENOMEM;
+    goto err_free_skx;
+  }
+
+  usb_make_path(usb_dev, skx->phys_path, sizeof(skx->phys_path));
+  strlcat(skx->phys_path, "/input0", sizeof(skx->phys_path));
+  dev_dbg(&interface->dev, "Recieved Device Path: %s", skx->phys_path);
+
+  skx->interface=interface;
+  skx->usb_dev=usb_dev;
+  mutex_init(&skx->interval_lock);
+  mutex_init(&skx->curve_lock);
+  mutex_init(&skx->capture_lock);
+  INIT_DELAYED_WORK(&skx->hs_work, skx_hs_timeout);
+  INIT_DELAYED_WORK(&skx->err_work, skx_recover);
+  spin_lock_init(&skx->err_lock);
+  skx->name = "Microsoft X-Box One S pad";
+  skx_keymap_reset(&skx->keymap);
+
+  err = skx_init_output(interface, skx);
+  if (err)
+    goto err_free_stats;
+
+  err = skx_init_input_ring(interface, skx);
+  if (err)
+    goto err_free_output;
+
+  usb_set_intfdata(interface, skx);
+
+  err = skx_init_input(skx);
+  if (err)
+    goto err_free_ring;
+
+  /* Not fatal, the pad works without it */
+  err = skx_init_raw(skx);
+  if (err)
+    dev_warn(&interface->dev, "SKX: no raw report device: %d\n", err);
+
+  skx->in_interval_orig = alt->endpoint[1].desc.bInterval;
+  skx->out_interval_orig = alt->endpoint[0].desc.bInterval;
+  if (in_interval || out_interval)
+    skx_apply_intervals(skx, in_interval, out_interval);
+
+  /* The handshake carries on from the URB completions */
+  err = skx_start_input(skx);
+  if (err)
+    goto err_unregister;
+
+  skx_init_debugfs(skx);
+
+  return 0;
+
+err_unregister:
+  /* As skx_disconnect(): unregistering may still send an FF stop */
+  skx_stop_recovery(skx);
+  usb_kill_anchored_urbs(&skx->interrupt_in_anchor);
+  skx_free_raw(skx);
+  input_unregister_device(skx->dev);
+  hrtimer_cancel(&skx->ff_timer);
+  skx_stop_output(skx);
+  alt->endpoint[1].desc.bInterval = skx->in_interval_orig;
+  alt->endpoint[0].desc.bInterval = skx->out_interval_orig;
+err_free_ring:
+  usb_set_intfdata(interface, NULL);
+  skx_free_input_ring(skx);
+err_free_output:
+  skx_free_output(skx);
+err_free_stats:
+  free_percpu(skx->stats);
+err_free_skx:
+  kfree(skx);
+  return err;
+}
+
+static void skx_raw_release_ref(struct kref *ref)
+{
+  struct skx_raw *raw = container_of(ref, struct skx_raw, ref);
+
+  vfree(raw->haptic.ring);
+  vfree(raw->ring);
+  kfree(raw);
+}
+
+static int skx_raw_open(struct inode *inode, struct file *file)
+{
+  /* misc_open() holds misc_mtx, misc_deregister() can't have dropped the pad's ref yet */
+  struct skx_raw *raw = container_of(file->private_data, struct skx_raw, misc);
+  struct skx_raw_client *client;
+  int err;
+
+  client = kzalloc(sizeof(*client), GFP_KERNEL);
+  if (!client)
+    return -ENOMEM;
+
+  /* An autosuspended pad has no input URBs queued, so readers keep it awake */
+  mutex_lock(&raw->lock);
+  err = raw->skx ? usb_autopm_get_interface(raw->skx->interface) : -ENODEV;
+  mutex_unlock(&raw->lock);
+  if (err) {
+    kfree(client);
+    return err;
+  }
+
+  kref_get(&raw->ref);
+  client->raw = raw;
+  client->seen = smp_load_acquire(&raw->ring->head);
+  file->private_data = client;
+
+  return nonseekable_open(inode, file);
+}
+
+static int skx_raw_release(struct inode *inode, struct file *file)
+{
+  struct skx_raw_client *client = file->private_data;
+  struct skx_raw *raw = client->raw;
+
+  /* Once the pad is unbound the USB core has dropped what was left of our references */
+  mutex_lock(&raw->lock);
+  if (raw->skx)
+    usb_autopm_put_interface(raw->skx->interface);
+  mutex_unlock(&raw->lock);
+
+  kref_put(&raw->ref, skx_raw_release_ref);
+  kfree(client);
+
+  return 0;
+}
+
+static int skx_raw_mmap(struct file *file, struct vm_area_struct *vma)
+{
+  struct skx_raw_client *client = file->private_data;
+
+  if (vma->vm_pgoff == SKX_HAPTIC_OFFSET >> PAGE_SHIFT)
+    return remap_vmalloc_range(vma, client->raw->haptic.ring, 0);
+
+  if (vma->vm_flags & VM_WRITE)
+    return -EPERM;
+  vm_flags_clear(vma, VM_MAYWRITE);
+
+  return remap_vmalloc_range(vma, client->raw->ring, vma->vm_pgoff);
+}
+
+static __poll_t skx_raw_poll(struct file *file, poll_table *wait)
+{
+  struct skx_raw_client *client = file->private_data;
+  struct skx_raw *raw = client->raw;
+  __poll_t mask = 0;
+  u32 head;
+
+  poll_wait(file, &raw->wait, wait);
+  poll_wait(file, &raw->haptic_wait, wait);
+
+  if (READ_ONCE(raw->gone))
+    return EPOLLHUP | EPOLLERR;
+
+  head = smp_load_acquire(&raw->haptic.ring->head);
+  if (head - READ_ONCE(raw->haptic.tail) <= SKX_HAPTIC_FRAMES / 2)
+    mask |= EPOLLOUT | EPOLLWRNORM;
+
+  head = smp_load_acquire(&raw->ring->head);
+  if (head != client->seen) {
+    client->seen = head;
+    mask |= EPOLLIN | EPOLLRDNORM;
+  }
+
+  return mask;
+}
+
+/* Kicks an idle haptic stream, whatever was written */
+static ssize_t skx_raw_write(struct file *file, const char __user *buf, size_t count,
+    loff_t *ppos)
+{
+  struct skx_raw_client *client = file->private_data;
+  struct skx_raw *raw = client->raw;
+  struct usb_skx *skx;
+  unsigned long flags;
+  int err;
+
+  mutex_lock(&raw->lock);
+
+  skx = raw->skx;
+  if (!skx) {
+    err = -ENODEV;
+    goto out;
+  }
+
+  err = usb_autopm_get_interface(skx->interface);
+  if (err)
+    goto out;
+
+  spin_lock_irqsave(&skx->output_data_lock, flags);
+  err = skx_send_packet(skx);
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+
+  usb_autopm_put_interface(skx->interface);
+
+out:
+  mutex_unlock(&raw->lock);
+  return err ? err : count;
+}
+
+static const struct file_operations skx_raw_fops = {
+  .owner = THIS_MODULE,
+  .open = skx_raw_open,
+  .release = skx_raw_release,
+  .mmap = skx_raw_mmap,
+  .poll = skx_raw_poll,
+  .write = skx_raw_write,
+};
+
+static int skx_init_raw(struct usb_skx *skx)
+{
+  struct skx_raw *raw;
+  int err;
+
+  raw = kzalloc(sizeof(*raw), GFP_KERNEL);
+  if (!raw)
+    return -ENOMEM;
+
+  raw->ring = vmalloc_user(sizeof(*raw->ring));
+  if (!raw->ring) {
+    err = -ENOMEM;
+    goto err_free;
+  }
+  raw->ring->slots = SKX_RAW_SLOTS;
+  raw->ring->slot_size = sizeof(struct skx_raw_slot);
+
+  raw->haptic.ring = vmalloc_user(sizeof(*raw->haptic.ring));
+  if (!raw->haptic.ring) {
+    err = -ENOMEM;
+    goto err_free_ring;
+  }
+  raw->haptic.ring->frames = SKX_HAPTIC_FRAMES;
+
+  kref_init(&raw->ref);
+  init_waitqueue_head(&raw->wait);
+  init_waitqueue_head(&raw->haptic_wait);
+  mutex_init(&raw->lock);
+  raw->skx = skx;
+
+  raw->id = ida_alloc(&skx_raw_ida, GFP_KERNEL);
+  if (raw->id < 0) {
+    err = raw->id;
+    goto err_free_ring;
+  }
+  snprintf(raw->name, sizeof(raw->name), "skxraw%d", raw->id);
+
+  raw->misc.minor = MISC_DYNAMIC_MINOR;
+  raw->misc.name = raw->name;
+  raw->misc.fops = &skx_raw_fops;
+  raw->misc.parent = &skx->interface->dev;
+
+  err = misc_register(&raw->misc);
+  if (err)
+    goto err_free_id;
+
+  skx->raw = raw;
+  skx->out.haptic = &raw->haptic;
+  return 0;
+
+err_free_id:
+  ida_free(&skx_raw_ida, raw->id);
+err_free_ring:
+  vfree(raw->haptic.ring);
+  vfree(raw->ring);
+err_free:
+  kfree(raw);
+  return err;
+}
+
+/*
+  Called once the input URBs are dead, so nothing writes the report ring
+  any more; the OUT completion lets go of the haptic ring under
+  output_data_lock.
+*/
+static void skx_free_raw(struct usb_skx *skx)
+{
+  struct skx_raw *raw = skx->raw;
+  unsigned long flags;
+
+  if (!raw)
+    return;
+
+  misc_deregister(&raw->misc);
+  ida_free(&skx_raw_ida, raw->id);
+
+  mutex_lock(&raw->lock);
+  raw->skx = NULL;
+  mutex_unlock(&raw->lock);
+
+  spin_lock_irqsave(&skx->output_data_lock, flags);
+  skx->out.haptic = NULL;
+  skx->raw = NULL;
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+
+  WRITE_ONCE(raw->gone, true);
+  wake_up_interruptible_all(&raw->wait);
+  wake_up_interruptible_all(&raw->haptic_wait);
+
+  kref_put(&raw->ref, skx_raw_release_ref);
+}
+
+/*
+  Does what skx_out_send() and skx_out_complete() leave to the driver
+  besides the submit. Called with output_data_lock held.
+*/
+static void skx_out_events(struct usb_skx *skx, unsigned int todo)
+{
+  if (todo & SKX_OUT_HS_WAIT)
+    schedule_delayed_work(&skx->hs_work, msecs_to_jiffies(SKX_HS_TIMEOUT_MS));
+
+  /* The stream drives the motors around the FF engine, see skx_ff_update() */
+  if (todo & SKX_OUT_HAPTIC) {
+    set_bit(SKX_FF_STALE, &skx->ff_flags);
+    if (wq_has_sleeper(&skx->raw->haptic_wait))
+      wake_up_interruptible(&skx->raw->haptic_wait);
+  }
+
+  if (todo & SKX_OUT_HAPTIC_DRY) {
+    /* ff_lock nests outside this lock, so the engine is left to the timer */
+    set_bit(SKX_FF_KICK, &skx->ff_flags);
+    hrtimer_start(&skx->ff_timer, ktime_get(), HRTIMER_MODE_ABS);
+  }
+}
+
+/*
+  Single producer: completions of the IN endpoint never run concurrently.
+  Readers only ever look at slots below head, so publishing head last is
+  all the locking there is.
+*/
+static void skx_raw_push(struct skx_raw *raw, const struct urb *urb, ktime_t ts)
+{
+  struct skx_raw_ring *ring = raw->ring;
+  u32 head = ring->head;
+  struct skx_raw_slot *slot = &ring->slot[head % SKX_RAW_SLOTS];
+
+  slot->timestamp = ktime_to_ns(ts);
+  slot->seq = head;
+  slot->len = min_t(u32, urb->actual_length, SKX_RAW_REPORT);
+  memcpy(slot->data, urb->transfer_buffer, SKX_RAW_REPORT);
+
+  smp_store_release(&ring->head, head + 1);
+
+  if (wq_has_sleeper(&raw->wait))
+    wake_up_interruptible(&raw->wait);
+}
+
+/*
+  Records a completed URB in the capture ring. Only called behind
+  skx_capture_key, so with no capture running the completions pay for a
+  patched out branch and nothing else.
+*/
+static void skx_capture(struct usb_skx *skx, const struct urb *urb, const u8 *data, u32 len,
+    ktime_t ts)
+{
+  struct skx_capture_rec *rec;
+  u32 n;
+
+  if (!smp_load_acquire(&skx->capture_on))
+    return;
+
+  n = atomic_inc_return(&skx->capture->head) - 1;
+  rec = &skx->capture->rec[n % SKX_CAPTURE_SLOTS];
+
+  WRITE_ONCE(rec->seq, 0);
+  smp_wmb();
+
+  rec->ts = ts;
+  rec->status = urb->status;
+  rec->interval = urb->interval;
+  rec->ep = usb_pipeendpoint(urb->pipe) | (usb_pipein(urb->pipe) ? USB_DIR_IN : 0);
+  rec->len = min_t(u32, len, PKT_LEN);
+  memcpy(rec->data, data, rec->len);
+
+  smp_store_release(&rec->seq, n + 1);
+}
+
+/* Input rate and jitter, over 0x20 reports only */
+static void skx_track_rate(struct usb_skx *skx, ktime_t ts)
+{
+  s64 gap;
+
+  if (ktime_to_ns(ktime_sub(ts, skx->in_window)) >= NSEC_PER_SEC) {
+    WRITE_ONCE(skx->in_rate, div64_u64((u64)skx->in_window_reports * NSEC_PER_SEC,
+          ktime_to_ns(ktime_sub(ts, skx->in_window))));
+    skx->in_window = ts;
+    skx->in_window_reports = 0;
+  }
+  skx->in_window_reports++;
+
+  gap = ktime_to_ns(ktime_sub(ts, skx->in_last));
+  if (skx->in_last && skx->in_last_gap)
+    WRITE_ONCE(skx->in_jitter, skx->in_jitter + abs(gap - skx->in_last_gap) - skx->in_jitter / 16);
+  skx->in_last_gap = skx->in_last ? gap : 0;
+  WRITE_ONCE(skx->in_last, ts);
+}
+
+static void skx_interrupt_in(struct urb *urb)
+{
+  struct usb_skx *skx = urb->context;
+  struct device *d = &skx->interface->dev;
+  struct skx_gip_header hdr;
+  int err;
+  unsigned char data[PKT_LEN];
+  ktime_t ts = ktime_get();
+  bool dry;
+
+  /*
+    If no other URB of the ring was queued when this one completed, the
+    endpoint had nothing to complete into until we resubmit below. URBs
+    killed on purpose, or by the pad going away, empty the ring without
+    it running dry.
+  */
+  dry = atomic_dec_return(&skx->in_urbs_active) == 0;
+
+  err = urb->status;
+  if (dry && err != -ECONNRESET && err != -ENOENT && err != -ESHUTDOWN && err != -ENODEV)
+    atomic_inc(&skx->in_ring_dry);
+
+  trace_skx_in_urb_complete(skx->usb_dev, err, urb->transfer_buffer, urb->actual_length);
+
+  if (static_branch_unlikely(&skx_capture_key))
+    skx_capture(skx, urb, urb->transfer_buffer, urb->actual_length, ts);
+
+  if (err)
+    skx_stat_inc(skx, in_urb_errors[skx_status_index(err)]);
+
+  switch (err) {
+  case 0:
+    break;
+  case -ECONNRESET:
+  case -ENOENT:
+  case -ESHUTDOWN:
+  case -ENODEV:
+    dev_dbg(d, "SKX: input urb error: %d\n",  err);
+    return;
+  default:
+    /* Resubmitting straight away would only fail again, as fast as the bus allows */
+    dev_dbg(d, "SKX: input urb status %d, recovering\n", err);
+    skx_urb_fault(skx, err, SKX_ERR_IN_HALT);
+    return;
+  }
+
+  if (skx->raw)
+    skx_raw_push(skx->raw, urb, ts);
+
+  if (!skx_gip_parse(urb->transfer_buffer, urb->actual_length, &hdr)) {
+    skx_stat_inc(skx, gip_malformed);
+    dev_dbg(d, "SKX: malformed GIP header, %u bytes\n", urb->actual_length);
+    skx_submit_in_urb(skx, urb, GFP_ATOMIC);
+    return;
+  }
+
+  /* Heartbeats, the guide button and announcements would make an idle pad look busy */
+  if (hdr.command == GIP_CMD_INPUT)
+    skx_track_rate(skx, ts);
+
+  if (hdr.options & GIP_OPT_CHUNK) {
+    skx_gip_chunk_in(skx, urb, &hdr, ts);
+    return;
+  }
+
+  /*
+    Take a copy of the report and hand the URB straight back to the host
+    controller, so the endpoint is never left without a URB while we decode.
+  */
+  memcpy(data, urb->transfer_buffer, PKT_LEN);
+  skx_submit_in_urb(skx, urb, GFP_ATOMIC);
+
+  if (hdr.options & GIP_OPT_ACK)
+    skx_gip_ack(skx, &hdr, hdr.length, 0);
+
+  skx_process_packet(skx, &hdr, data, ts);
+}
+
+/*
+  Emit only the buttons and axes whose bits changed since the previous
+  report. Buttons and the hat mirror the input core's own state exactly, so
+  skipping unchanged ones is invisible to userspace. Fuzzed axes are the
+  exception: the core's fuzz filter may still be walking towards an
+  unchanged raw value, so those are only skipped once the core holds it.
+*/
+static void skx_emit(void *ctx, unsigned int type, unsigned int code, int value, bool changed)
+{
+  struct input_dev *dev = ctx;
+
+  /* The fuzz filter may have held back an earlier value of this axis */
+  if (!changed && input_abs_get_val(dev, code) == value)
+    return;
+
+  input_event(dev, type, code, value);
+}
+
+static void skx_decode_report(struct usb_skx *skx, const unsigned char *data)
+{
+  struct skx_curve_set *curves;
+  u8 shaped[REPORT_LEN];
+
+  rcu_read_lock();
+  curves = rcu_dereference(skx->curves);
+  if (curves) {
+    skx_shape_sticks(curves->sticks, data, shaped);
+    data = shaped;
+  }
+  rcu_read_unlock();
+
+  skx_decode_fields(skx->last_report, data, skx->keymap.field, skx_emit, skx->dev);
+}
+
+static noinline void skx_debug_report(struct device *d, const unsigned char *data)
+{
+  int i;
+
+  for (i = 0; i < ARRAY_SIZE(skx_debug_bits); i++) {
+    if (data[skx_debug_bits[i].offset] & skx_debug_bits[i].mask)
+      dev_printk(KERN_DEBUG, d, "%s pressed.\n", skx_debug_bits[i].name);
+  }
+
+  if (data[6] == 0xFF && data[7] == 3)
+    dev_printk(KERN_DEBUG, d, "Left Trigger pressed fully down.\n");
+  if (data[8] == 0xFF && data[9] == 3)
+    dev_printk(KERN_DEBUG, d, "Right Trigger pressed fully down.\n");
+  if(data[11] >= 127 && data[11] < 130)
+    dev_printk(KERN_DEBUG, d, "Left Stick pressed fully outwards on X axis.\n");
+  if(data[13] >= 127 && data[13] < 130)
+    dev_printk(KERN_DEBUG, d, "Left Stick pressed fully outwards on Y axis.\n");
+  if(data[15] >= 127 && data[15] < 130)
+    dev_printk(KERN_DEBUG, d, "Right Stick pressed fully outwards on X axis.\n");
+  if(data[17] >= 127 && data[17] < 130)
+    dev_printk(KERN_DEBUG, d, "Right Stick pressed fully outwards on Y axis.\n");
+}
+
+static int skx_submit_in_urb(struct usb_skx *skx, struct urb *urb, gfp_t mem_flags)
+{
+  int err;
+
+  usb_anchor_urb(urb, &skx->interrupt_in_anchor);
+  atomic_inc(&skx->in_urbs_active);
+
+  err = usb_submit_urb(urb, mem_flags);
+  if (err) {
+    atomic_dec(&skx->in_urbs_active);
+    usb_unanchor_urb(urb);
+    if (err != -EPERM && err != -ENODEV) {
+      atomic_inc(&skx->in_resubmit_failed);
+      dev_err(&skx->interface->dev, "SKX: input usb_submit_urb failed: %d\n", err);
+    }
+  }
+
+  return err;
+}
+
+/*
+  Queues the ack of a message (or of a chunk of one) the pad asked to have
+  acked, so it doesn't time out and send it again.
+*/
+static void skx_gip_ack(struct usb_skx *skx, const struct skx_gip_header *hdr, u16 received,
+    u16 remaining)
+{
+  struct output_packet *packet;
+  unsigned long flags;
+  u8 ack[ACK_LEN];
+
+  skx_build_ack(ack, hdr, received, remaining);
+
+  spin_lock_irqsave(&skx->output_data_lock, flags);
+
+  packet = skx_queue_packet(skx, SKX_OUT_ACK);
+  if (packet) {
+    memcpy(packet->data, ack, ACK_LEN);
+    packet->len = ACK_LEN;
+    trace_skx_packet_queued(skx->usb_dev, SKX_OUT_ACK, packet->data, packet->len,
+        skx->out.queues[SKX_OUT_ACK].count);
+    skx_stat_inc(skx, gip_acks);
+    skx_send_packet(skx);
+  } else {
+    skx_stat_inc(skx, out_dropped);
+    dev_dbg(&skx->interface->dev, "SKX: ack queue full, dropping ack of 0x%02x\n", hdr->command);
+  }
+
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+}
+
+/* Handlers get the message with its header in front, hdr->size bytes of it */
+static void skx_gip_announce(struct usb_skx *skx, const struct skx_gip_header *hdr,
+    const u8 *data, ktime_t ts)
+{
+  const u8 *payload = data + hdr->size;
+
+  dev_dbg(&skx->interface->dev, "SKX: announce from %04x:%04x\n",
+      le16_to_cpup((__le16 *)(payload + 8)), le16_to_cpup((__le16 *)(payload + 10)));
+}
+
+static void skx_gip_status(struct usb_skx *skx, const struct skx_gip_header *hdr,
+    const u8 *data, ktime_t ts)
+{
+  WRITE_ONCE(skx->gip_status, data[hdr->size]);
+  WRITE_ONCE(skx->gip_status_at, ts);
+}
+
+static void skx_gip_identify(struct usb_skx *skx, const struct skx_gip_header *hdr,
+    const u8 *data, ktime_t ts)
+{
+  dev_dbg(&skx->interface->dev, "SKX: identify, %u bytes\n", hdr->length);
+}
+
+/*
+  Stamps the frame about to be reported with the completion time of the
+  URB it came in, less the host controller delay, rather than the time
+  the input core gets to it. The GIP sequence byte goes out as MSC_SERIAL,
+  so a gap shows a frame was lost.
+*/
+static void skx_stamp_frame(struct usb_skx *skx, const struct skx_gip_header *hdr, ktime_t ts)
+{
+  input_set_timestamp(skx->dev, ktime_sub_ns(ts, READ_ONCE(skx->in_delay_ns)));
+  input_event(skx->dev, EV_MSC, MSC_SERIAL, hdr->sequence);
+}
+
+static void skx_gip_guide(struct usb_skx *skx, const struct skx_gip_header *hdr,
+    const u8 *data, ktime_t ts)
+{
+  if (unlikely(READ_ONCE(skx->out.hs_state) != SKX_HS_READY))
+    skx_hs_report(skx, ts);
+
+  skx_stamp_frame(skx, hdr, ts);
+  input_report_key(skx->dev, BTN_MODE, data[hdr->size] & 0x01);
+  trace_skx_report_decoded(skx->usb_dev, data);
+  input_sync(skx->dev);
+  trace_skx_input_sync(skx->usb_dev, data);
+  skx_stat_inc(skx, sync_latency[skx_hist_bucket(ktime_sub(ktime_get(), ts))]);
+}
+
+/* The decoder works on offsets into the whole packet, which has a 4 byte header */
+static void skx_gip_input(struct usb_skx *skx, const struct skx_gip_header *hdr,
+    const u8 *data, ktime_t ts)
+{
+  unsigned long flags;
+  ktime_t now, next;
+
+  if (unlikely(READ_ONCE(skx->out.hs_state) != SKX_HS_READY))
+    skx_hs_report(skx, ts);
+
+  skx_stamp_frame(skx, hdr, ts);
+  skx_decode_report(skx, data);
+
+  trace_skx_report_decoded(skx->usb_dev, data);
+
+  if (static_branch_unlikely(&skx_debug_reports))
+    skx_debug_report(&skx->interface->dev, data);
+
+  input_sync(skx->dev);
+  trace_skx_input_sync(skx->usb_dev, data);
+  skx_stat_inc(skx, sync_latency[skx_hist_bucket(ktime_sub(ktime_get(), ts))]);
+
+  /*
+    Playing springs and dampers follow the controls report by report. A
+    step held off for the OUT interval goes to the timer, which is never
+    armed for later than that.
+  */
+  spin_lock_irqsave(&skx->ff_lock, flags);
+  now = ktime_get();
+  next = skx_ff_track(&skx->ff, data, ts);
+  if (!ktime_after(next, now))
+    skx_ff_update(skx, now);
+  else if (next != KTIME_MAX)
+    hrtimer_start(&skx->ff_timer, next, HRTIMER_MODE_ABS);
+  spin_unlock_irqrestore(&skx->ff_lock, flags);
+}
+
+struct skx_gip_handler {
+  void (*handle)(struct usb_skx *skx, const struct skx_gip_header *hdr, const u8 *data, ktime_t ts);
+  u8 stat;
+  u8 min_len;    /* shortest payload the handler can take */
+  u8 header;     /* header size the handler relies on, 0 if any (reassembled too) */
+};
+
+/* Incoming messages by GIP command, anything not in here is counted and dropped */
+static const struct skx_gip_handler skx_gip_handlers[] = {
+  [GIP_CMD_ANNOUNCE] = { skx_gip_announce, SKX_STAT_REPORT_02, 12, 0 },
+  [GIP_CMD_STATUS] = { skx_gip_status, SKX_STAT_REPORT_03, 1, 0 },
+  [GIP_CMD_IDENTIFY] = { skx_gip_identify, SKX_STAT_REPORT_04, 0, 0 },
+  [GIP_CMD_GUIDE] = { skx_gip_guide, SKX_STAT_REPORT_07, 1, 0 },
+  [GIP_CMD_INPUT] = { skx_gip_input, SKX_STAT_REPORT_20, REPORT_LEN - 4, 4 },
+};
+
+static void skx_process_packet(struct usb_skx *skx, const struct skx_gip_header *hdr,
+    const u8 *data, ktime_t ts)
+{
+  const struct skx_gip_handler *h = NULL;
+
+  if (hdr->command < ARRAY_SIZE(skx_gip_handlers))
+    h = &skx_gip_handlers[hdr->command];
+
+  if (!h || !h->handle || hdr->length < h->min_len || (h->header && hdr->size != h->header)) {
+    skx_stat_inc(skx, reports[SKX_STAT_REPORT_OTHER]);
+    dev_dbg(&skx->interface->dev, "SKX: ignoring GIP 0x%02x, %u bytes\n",
+        hdr->command, hdr->length);
+    return;
+  }
+
+  skx_stat_inc(skx, reports[h->stat]);
+  h->handle(skx, hdr, data, ts);
+}
+
+/*
+  A chunk is copied straight from the URB's buffer into the reassembly
+  buffer before the URB is handed back; the message is dispatched from
+  there once complete.
+*/
+static void skx_gip_chunk_in(struct usb_skx *skx, struct urb *urb,
+    const struct skx_gip_header *hdr, ktime_t ts)
+{
+  struct skx_gip_msg *msg = &skx->gip_msg;
+  struct skx_gip_header whole;
+  u32 received;
+  int len;
+
+  len = skx_gip_chunk(msg, hdr, (u8 *)urb->transfer_buffer + hdr->size, &received);
+  skx_submit_in_urb(skx, urb, GFP_ATOMIC);
+
+  /* Even a dropped message is acked, or the pad keeps sending it */
+  if (hdr->options & GIP_OPT_ACK)
+    skx_gip_ack(skx, hdr, received, msg->total > received ? msg->total - received : 0);
+
+  if (len < 0) {
+    skx_stat_inc(skx, gip_chunk_errors);
+    dev_dbg(&skx->interface->dev, "SKX: dropping chunked GIP 0x%02x: %d\n", hdr->command, len);
+    return;
+  }
+  if (!len)
+    return;
+
+  whole = *hdr;
+  whole.options &= ~(GIP_OPT_CHUNK | GIP_OPT_CHUNK_START);
+  whole.size = 0;
+  whole.length = len;
+  whole.chunk_offset = 0;
+
+  skx_process_packet(skx, &whole, msg->data, ts);
+}
+
+static void skx_interrupt_out(struct urb *urb)
+{
+  struct usb_skx *skx = urb->context;
+  struct device *d = &skx->interface->dev;
+  int status = urb->status;
+  unsigned int todo = 0;
+  unsigned long flags;
+
+  spin_lock_irqsave(&skx->output_data_lock, flags);
+
+  trace_skx_out_urb_complete(skx->usb_dev, status, skx->output_data, urb->actual_length);
+
+  /* Before the next packet is taken into output_data */
+  if (static_branch_unlikely(&skx_capture_key))
+    skx_capture(skx, urb, skx->output_data, urb->transfer_buffer_length, ktime_get());
+
+  if (status) {
+    skx_stat_inc(skx, out_urb_errors[skx_status_index(status)]);
+  } else {
+    skx_stat_inc(skx, out_packets);
+    if (skx->out.stamp)
+      skx_stat_inc(skx, ff_latency[skx_hist_bucket(ktime_sub(ktime_get(), skx->out.stamp))]);
+  }
+
+  switch (status) {
+  case 0:
+    todo = skx_out_complete(&skx->out, skx->output_data);
+    break;
+
+  case -ECONNRESET:
+  case -ENOENT:
+  case -ESHUTDOWN:
+  case -ENODEV:
+    dev_dbg(d, "SKX: output urb error: %d\n", status);
+    skx->out.active = false;
+    break;
+
+  default:
+    /* Held back until skx_recover() restarts the output */
+    dev_dbg(d, "SKX: output urb status %d, recovering\n", status);
+    skx->out.active = false;
+    skx->out.paused = true;
+    skx_urb_fault(skx, status, SKX_ERR_OUT_HALT);
+    break;
+  }
+
+  skx_out_submit(skx, todo);
+
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+}
+
+/*
+  Carries out what skx_out_send() or skx_out_complete() returned, submitting
+  the packet they left in output_data if there is one. Called with
+  output_data_lock held.
+*/
+static int skx_out_submit(struct usb_skx *skx, unsigned int todo)
+{
+  struct urb *urb = skx->interrupt_out;
+  int err;
+
+  skx_out_events(skx, todo);
+  if (!(todo & SKX_OUT_SUBMIT))
+    return 0;
+
+  urb->transfer_buffer_length = skx->out.len;
+  usb_anchor_urb(urb, &skx->interrupt_out_anchor);
+  trace_skx_out_urb_submit(skx->usb_dev, 0, skx->output_data, urb->transfer_buffer_length);
+  err = usb_submit_urb(urb, GFP_ATOMIC);
+  if (err) {
+    dev_err(&skx->interface->dev, "SKX: usb_submit_urb failed: %d\n", err);
+    usb_unanchor_urb(urb);
+    skx->out.active = false;
+    return -EIO;
+  }
+
+  return 0;
+}
+
+static int skx_send_packet(struct usb_skx *skx)
+{
+  return skx_out_submit(skx, skx_out_send(&skx->out, skx->output_data));
+}
+
+/*
+  Returns the packet to fill for the given class, or NULL if that class is
+  full. For haptics this is the still unsent packet, if there is one.
+  Called with output_data_lock held.
+*/
+static struct output_packet *skx_queue_packet(struct usb_skx *skx, enum skx_out_class cls)
+{
+  struct output_packet *packet;
+  bool pending;
+
+  packet = skx_out_queue(skx->out.queues, cls, &pending);
+  if (pending)
+    skx_stat_inc(skx, ff_overwritten);
+  else if (packet)
+    skx->out_queue_hwm = max(skx->out_queue_hwm, skx_out_depth(skx->out.queues));
+
+  return packet;
+}
+
+/*
+  Nothing may be submitted past this point, not even by hs_work, so
+  output_data can be freed once this returns.
+*/
+static void skx_stop_output(struct usb_skx *skx)
+{
+  unsigned long flags;
+
+  spin_lock_irqsave(&skx->output_data_lock, flags);
+  skx->out.paused = true;
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+
+  usb_kill_anchored_urbs(&skx->interrupt_out_anchor);
+  cancel_delayed_work_sync(&skx->hs_work);
+}
+
+static void skx_disconnect(struct usb_interface *interface)
+{
+  struct usb_skx *skx = usb_get_intfdata(interface);
+
+  skx_stop_recovery(skx);
+  debugfs_remove_recursive(skx->debugfs);
+  if (skx->capture_on)
+    static_branch_dec(&skx_capture_key);
+
+  usb_kill_anchored_urbs(&skx->interrupt_in_anchor);
+  skx_free_raw(skx);
+
+  input_unregister_device(skx->dev);
+  hrtimer_cancel(&skx->ff_timer);
+
+  usb_wait_anchor_empty_timeout(&skx->interrupt_out_anchor, 5000);
+  skx_stop_output(skx);
+
+  skx_free_output(skx);
+  skx_free_input_ring(skx);
+
+  interface->cur_altsetting->endpoint[1].desc.bInterval = skx->in_interval_orig;
+  interface->cur_altsetting->endpoint[0].desc.bInterval = skx->out_interval_orig;
+
+  /* The input URBs are dead, nobody is left reading the curves */
+  kvfree(rcu_access_pointer(skx->curves));
+  vfree(skx->capture);
+  free_percpu(skx->stats);
+  kfree(skx);
+
+  usb_set_intfdata(interface, NULL);
+}
+static int skx_init_output(struct usb_interface *interface, struct usb_skx *skx)
+{
+  init_usb_anchor(&skx->interrupt_out_anchor);
+
+  skx->output_data = usb_alloc_coherent(skx->usb_dev, PKT_LEN, GFP_KERNEL, &skx->output_data_dma);
+  if (!skx->output_data) {
+    return -ENOMEM;
+  }
 
   spin_lock_init(&skx->output_data_lock);
 
-  skx->interrupt_out = usb_alloc_urb(0, GFP_KERNEL);
-  if (!skx->interrupt_out) {
-    usb_free_coherent(skx->usb_dev, PKT_LEN, skx->output_data, skx->output_data_dma);
-    return -ENOMEM;
+  skx->interrupt_out = usb_alloc_urb(0, GFP_KERNEL);
+  if (!skx->interrupt_out) {
+    usb_free_coherent(skx->usb_dev, PKT_LEN, skx->output_data, skx->output_data_dma);
+    return -ENOMEM;
+  }
+
+  skx_fill_out_urb(skx);
+
+  skx->interrupt_out->transfer_dma = skx->output_data_dma;
+  skx->interrupt_out->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+  return 0;
+}
+
+static void skx_free_output(struct usb_skx *skx)
+{
+  usb_free_urb(skx->interrupt_out);
+  usb_free_coherent(skx->usb_dev, PKT_LEN, skx->output_data, skx->output_data_dma);
+}
+
+/* (Re)fills the OUT URB from the endpoint descriptor, interval included */
+static void skx_fill_out_urb(struct usb_skx *skx)
+{
+  struct usb_endpoint_descriptor *interrupt_out;
+
+  /* Xbox One controller has in/out endpoints swapped. */
+  interrupt_out = &skx->interface->cur_altsetting->endpoint[0].desc;
+
+  usb_fill_int_urb(skx->interrupt_out, skx->usb_dev,
+       usb_sndintpipe(skx->usb_dev, interrupt_out->bEndpointAddress),
+       skx->output_data, PKT_LEN,
+       skx_interrupt_out, skx, interrupt_out->bInterval);
+
+  skx->out_period = skx_interval_to_ktime(skx->usb_dev, interrupt_out->bInterval);
+}
+
+static int skx_init_input_ring(struct usb_interface *interface, struct usb_skx *skx)
+{
+  struct input_urb *slot;
+  unsigned int i;
+
+  init_usb_anchor(&skx->interrupt_in_anchor);
+  atomic_set(&skx->in_urbs_active, 0);
+
+  skx->num_in_urbs = clamp_t(unsigned int, in_urbs, 1, MAX_IN_URBS);
+
+  for (i = 0; i < skx->num_in_urbs; i++) {
+    slot = &skx->in_ring[i];
+
+    slot->data = usb_alloc_coherent(skx->usb_dev, PKT_LEN, GFP_KERNEL, &slot->data_dma);
+    if (!slot->data)
+      goto err_free;
+
+    slot->urb = usb_alloc_urb(0, GFP_KERNEL);
+    if (!slot->urb)
+      goto err_free;
+
+    skx_fill_in_urb(skx, slot);
+
+    slot->urb->transfer_dma = slot->data_dma;
+    slot->urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+  }
+
+  return 0;
+
+err_free:
+  skx_free_input_ring(skx);
+  return -ENOMEM;
+}
+
+/* (Re)fills an input URB from the endpoint descriptor, interval included */
+static void skx_fill_in_urb(struct usb_skx *skx, struct input_urb *slot)
+{
+  struct usb_endpoint_descriptor *interrupt_in;
+
+  interrupt_in = &skx->interface->cur_altsetting->endpoint[1].desc;
+
+  usb_fill_int_urb(slot->urb, skx->usb_dev,
+       usb_rcvintpipe(skx->usb_dev, interrupt_in->bEndpointAddress),
+       slot->data, PKT_LEN,
+       skx_interrupt_in, skx, interrupt_in->bInterval);
+}
+
+static int skx_submit_in_ring(struct usb_skx *skx)
+{
+  unsigned int i;
+
+  for (i = 0; i < skx->num_in_urbs; i++) {
+    if (skx_submit_in_urb(skx, skx->in_ring[i].urb, GFP_KERNEL)) {
+      usb_kill_anchored_urbs(&skx->interrupt_in_anchor);
+      return -EIO;
+    }
+  }
+
+  return 0;
+}
+
+static void skx_free_input_ring(struct usb_skx *skx)
+{
+  struct input_urb *slot;
+  unsigned int i;
+
+  for (i = 0; i < skx->num_in_urbs; i++) {
+    slot = &skx->in_ring[i];
+
+    usb_free_urb(slot->urb);
+    if (slot->data)
+      usb_free_coherent(skx->usb_dev, PKT_LEN, slot->data, slot->data_dma);
+
+    slot->urb = NULL;
+    slot->data = NULL;
+  }
+}
+
+/*
+  The pad may only autosuspend while nobody has the input device open;
+  it cannot wake the host up for a report.
+*/
+static int skx_input_open(struct input_dev *dev)
+{
+  struct usb_skx *skx = input_get_drvdata(dev);
+
+  return usb_autopm_get_interface(skx->interface);
+}
+
+static void skx_input_close(struct input_dev *dev)
+{
+  struct usb_skx *skx = input_get_drvdata(dev);
+
+  usb_autopm_put_interface(skx->interface);
+}
+
+static void skx_set_abs(struct input_dev *indev, unsigned int code)
+{
+  switch (skx_axis_class(code)) {
+  case SKX_AXIS_STICK:
+    input_set_abs_params(indev, code, -SKX_AXIS_MAX - 1, SKX_AXIS_MAX, 16, 128);
+    break;
+  case SKX_AXIS_TRIGGER:
+    input_set_abs_params(indev, code, 0, SKX_TRIGGER_MAX, 0, 0);
+    break;
+  case SKX_AXIS_HAT:
+    input_set_abs_params(indev, code, -1, 1, 0, 0);
+    break;
+  case SKX_AXIS_NONE:
+    break;
+  }
+}
+
+/*
+  Allocates an input device with the capabilities of the current remap
+  profile, ready to be registered.
+*/
+static struct input_dev *skx_alloc_input(struct usb_skx *skx)
+{
+  const struct skx_report_field *f;
+  struct input_dev *indev;
+
+  indev = input_allocate_device();
+  if (!indev)
+    return NULL;
+  indev->name = skx->name;
+  indev->phys = skx->phys_path;
+  usb_to_input_id(skx->usb_dev, &indev->id);
+  indev->dev.parent = &skx->interface->dev;
+  indev->open = skx_input_open;
+  indev->close = skx_input_close;
+  input_set_drvdata(indev, skx);
+
+  __set_bit(EV_KEY, indev->evbit);
+  __set_bit(EV_ABS, indev->evbit);
+  __set_bit(EV_MSC, indev->evbit);
+  __set_bit(MSC_SERIAL, indev->mscbit);
+
+  /* The guide button has a message of its own and is not remapped */
+  __set_bit(BTN_MODE, indev->keybit);
+
+  for (f = skx->keymap.field; f < skx->keymap.field + SKX_REPORT_FIELDS; f++) {
+    if (f->type == SKX_FIELD_KEY)
+      __set_bit(f->code, indev->keybit);
+    else if (f->type != SKX_FIELD_NONE)
+      skx_set_abs(indev, f->code);
+  }
+
+  if (skx_create_ff(indev)) {
+    input_free_device(indev);
+    return NULL;
+  }
+
+  return indev;
+}
+
+static int skx_init_input(struct usb_skx *skx)
+{
+  int error;
+
+  skx_init_ff(skx);
+
+  skx->dev = skx_alloc_input(skx);
+  if (!skx->dev)
+    return -ENOMEM;
+
+  error = input_register_device(skx->dev);
+  if (error)
+  {
+    input_free_device(skx->dev);
+    return error;
+  }
+
+  return 0;
+}
+
+/*
+  Submits the input ring and starts the handshake. Only its first packet
+  goes out from here, the rest follows from the completions.
+*/
+static int skx_start_input(struct usb_skx *skx)
+{
+  /*
+    A fixed ack of GIP_CMD_IDENTIFY (0x04) with 58 bytes received, which
+    the pad waits for before it takes power on. It acks no message we
+    have seen; the announcement, like any message asking for one, is
+    acked through skx_gip_ack() as it comes in.
+  */
+  static const u8 identify_ack[] = {
+    0x01, 0x20, 0x00, 0x09, 0x00,
+    0x04, 0x20, 0x3a, 0x00, 0x00,
+    0x00, 0x80, 0x00
+  };
+  unsigned long flags;
+  int error;
+
+  error = skx_submit_in_ring(skx);
+  if (error)
+    return error;
+
+  spin_lock_irqsave(&skx->output_data_lock, flags);
+
+  /* Anything left over from before a suspend belongs to an old handshake */
+  memset(&skx->out.queues[SKX_OUT_INIT], 0, sizeof(skx->out.queues[SKX_OUT_INIT]));
+  skx->out.hs_state = SKX_HS_ACK;
+  skx->hs_tries = 0;
+  skx_queue_init_packet(skx, identify_ack, sizeof(identify_ack));
+
+  error = skx_send_packet(skx);
+
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+
+  if (error) {
+    usb_kill_anchored_urbs(&skx->interrupt_in_anchor);
+    return error;
+  }
+
+  return 0;
+}
+
+/*
+  Points the endpoints at new polling intervals, 0 restoring the pad's
+  own. Some host controllers (xHCI) only read the interval when the
+  endpoint is set up, so the descriptors are patched and the interface
+  reinstated; the URBs are refilled for the ones that go by urb->interval.
+  Called with no URBs in flight.
+*/
+static int skx_apply_intervals(struct usb_skx *skx, unsigned int in, unsigned int out)
+{
+  struct usb_host_interface *alt = skx->interface->cur_altsetting;
+  unsigned long flags;
+  unsigned int i;
+  int err;
+
+  alt->endpoint[1].desc.bInterval = in ? in : skx->in_interval_orig;
+  alt->endpoint[0].desc.bInterval = out ? out : skx->out_interval_orig;
+
+  err = usb_set_interface(skx->usb_dev, alt->desc.bInterfaceNumber, alt->desc.bAlternateSetting);
+  if (err)
+    dev_warn(&skx->interface->dev, "SKX: could not reinstate interface for new intervals: %d\n", err);
+
+  for (i = 0; i < skx->num_in_urbs; i++)
+    skx_fill_in_urb(skx, &skx->in_ring[i]);
+  skx_fill_out_urb(skx);
+
+  spin_lock_irqsave(&skx->ff_lock, flags);
+  skx->ff.period = skx->out_period;
+  spin_unlock_irqrestore(&skx->ff_lock, flags);
+
+  dev_dbg(&skx->interface->dev, "SKX: intervals in %u out %u\n",
+      alt->endpoint[1].desc.bInterval, alt->endpoint[0].desc.bInterval);
+
+  return err;
+}
+
+/*
+  Stops both endpoints, applies the new intervals and starts them again.
+  Output queued in the meantime is held back, an OUT packet that could
+  not finish within a second is lost. An autosuspended pad is woken up
+  for it, and held awake until the endpoints run again.
+*/
+static int skx_set_intervals(struct usb_skx *skx, unsigned int in, unsigned int out)
+{
+  unsigned long flags;
+  int err;
+
+  err = usb_autopm_get_interface(skx->interface);
+  if (err)
+    return err;
+
+  mutex_lock(&skx->interval_lock);
+  skx_stop_recovery(skx);
+
+  spin_lock_irqsave(&skx->output_data_lock, flags);
+  skx->out.paused = true;
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+
+  usb_kill_anchored_urbs(&skx->interrupt_in_anchor);
+  if (!usb_wait_anchor_empty_timeout(&skx->interrupt_out_anchor, 1000))
+    usb_kill_anchored_urbs(&skx->interrupt_out_anchor);
+
+  skx_apply_intervals(skx, in, out);
+
+  err = skx_submit_in_ring(skx);
+
+  spin_lock_irqsave(&skx->output_data_lock, flags);
+  skx->out.paused = false;
+  skx->out.active = false;
+  skx_send_packet(skx);
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+
+  clear_bit(SKX_ERR_STOPPED, &skx->err_flags);
+  mutex_unlock(&skx->interval_lock);
+
+  usb_autopm_put_interface(skx->interface);
+
+  return err;
+}
+
+/*
+  Stops all I/O for a suspend or a reset, keeping the input device and the
+  FF engine as they are. Whatever was still queued is stale by the time
+  the pad is back and is dropped; skx_resume() renders FF again. An
+  autosuspend is refused while rumble is playing or on its way.
+*/
+static int skx_suspend(struct usb_interface *interface, pm_message_t message)
+{
+  struct usb_skx *skx = usb_get_intfdata(interface);
+  unsigned long flags;
+  bool busy;
+
+  mutex_lock(&skx->interval_lock);
+
+  if (PMSG_IS_AUTO(message)) {
+    spin_lock_irqsave(&skx->ff_lock, flags);
+    busy = !bitmap_empty(skx->ff.active, FF_EFFECTS);
+    spin_unlock_irqrestore(&skx->ff_lock, flags);
+    if (busy)
+      goto err_busy;
+  }
+
+  spin_lock_irqsave(&skx->output_data_lock, flags);
+  if (PMSG_IS_AUTO(message) && (skx->out.active || skx_out_depth(skx->out.queues))) {
+    spin_unlock_irqrestore(&skx->output_data_lock, flags);
+    goto err_busy;
+  }
+  skx->out.paused = true;
+  memset(skx->out.queues, 0, sizeof(skx->out.queues));
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+
+  skx_stop_recovery(skx);
+  hrtimer_cancel(&skx->ff_timer);
+  usb_kill_anchored_urbs(&skx->interrupt_in_anchor);
+  usb_kill_anchored_urbs(&skx->interrupt_out_anchor);
+  cancel_delayed_work_sync(&skx->hs_work);
+
+  mutex_unlock(&skx->interval_lock);
+
+  dev_dbg(&interface->dev, "SKX: suspended\n");
+
+  return 0;
+
+err_busy:
+  mutex_unlock(&skx->interval_lock);
+  return -EBUSY;
+}
+
+/*
+  Brings the pad back after a suspend, a reset or a round of recovery:
+  the input ring is resubmitted and the init handshake replayed on the
+  same input device, so open evdev handles never notice. The pad comes
+  back with its motors off, so whatever should be playing by now is sent
+  again. Called with interval_lock held and no URBs in flight.
+*/
+static int skx_restart(struct usb_skx *skx)
+{
+  unsigned long flags;
+  int err;
+
+  spin_lock_irqsave(&skx->output_data_lock, flags);
+  skx->out.paused = false;
+  skx->out.active = false;
+  skx->hs_start = ktime_get();
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+
+  /* The input core released held keys meanwhile, so the next report is emitted in full */
+  memset(skx->last_report, 0, sizeof(skx->last_report));
+
+  err = skx_start_input(skx);
+
+  spin_lock_irqsave(&skx->ff_lock, flags);
+  memset(&skx->ff.sent, 0, sizeof(skx->ff.sent));
+  skx->ff.offload_end = 0;
+  skx_ff_update(skx, ktime_get());
+  spin_unlock_irqrestore(&skx->ff_lock, flags);
+
+  return err;
+}
+
+static int skx_resume(struct usb_interface *interface)
+{
+  struct usb_skx *skx = usb_get_intfdata(interface);
+  int err;
+
+  mutex_lock(&skx->interval_lock);
+
+  clear_bit(SKX_ERR_STOPPED, &skx->err_flags);
+  err = skx_restart(skx);
+  if (err)
+    dev_err(&interface->dev, "SKX: could not restart the pad: %d\n", err);
+
+  mutex_unlock(&skx->interval_lock);
+
+  dev_dbg(&interface->dev, "SKX: resumed\n");
+
+  return err;
+}
+
+static int skx_pre_reset(struct usb_interface *interface)
+{
+  return skx_suspend(interface, PMSG_SUSPEND);
+}
+
+static int skx_parse_interval(struct usb_skx *skx, const char *buf, unsigned int *interval)
+{
+  unsigned int max = skx->usb_dev->speed >= USB_SPEED_HIGH ? 16 : 255;
+  int err;
+
+  err = kstrtouint(buf, 0, interval);
+  if (err)
+    return err;
+
+  return *interval > max ? -EINVAL : 0;
+}
+
+static ssize_t in_interval_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  struct usb_interface *interface = to_usb_interface(dev);
+
+  return sysfs_emit(buf, "%u\n", interface->cur_altsetting->endpoint[1].desc.bInterval);
+}
+
+static ssize_t in_interval_store(struct device *dev, struct device_attribute *attr,
+    const char *buf, size_t count)
+{
+  struct usb_interface *interface = to_usb_interface(dev);
+  struct usb_skx *skx = usb_get_intfdata(interface);
+  unsigned int interval;
+  int err;
+
+  err = skx_parse_interval(skx, buf, &interval);
+  if (err)
+    return err;
+
+  err = skx_set_intervals(skx, interval,
+      interface->cur_altsetting->endpoint[0].desc.bInterval);
+
+  return err ? err : count;
+}
+static DEVICE_ATTR_RW(in_interval);
+
+static ssize_t out_interval_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  struct usb_interface *interface = to_usb_interface(dev);
+
+  return sysfs_emit(buf, "%u\n", interface->cur_altsetting->endpoint[0].desc.bInterval);
+}
+
+static ssize_t out_interval_store(struct device *dev, struct device_attribute *attr,
+    const char *buf, size_t count)
+{
+  struct usb_interface *interface = to_usb_interface(dev);
+  struct usb_skx *skx = usb_get_intfdata(interface);
+  unsigned int interval;
+  int err;
+
+  err = skx_parse_interval(skx, buf, &interval);
+  if (err)
+    return err;
+
+  err = skx_set_intervals(skx, interface->cur_altsetting->endpoint[1].desc.bInterval,
+      interval);
+
+  return err ? err : count;
+}
+static DEVICE_ATTR_RW(out_interval);
+
+/* Reports per second over the last second or so, 0 once the pad went quiet */
+static ssize_t in_rate_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  struct usb_skx *skx = usb_get_intfdata(to_usb_interface(dev));
+  ktime_t last = READ_ONCE(skx->in_last);
+
+  if (!last || ktime_ms_delta(ktime_get(), last) > 2 * MSEC_PER_SEC)
+    return sysfs_emit(buf, "0\n");
+
+  return sysfs_emit(buf, "%u\n", READ_ONCE(skx->in_rate));
+}
+static DEVICE_ATTR_RO(in_rate);
+
+static ssize_t in_jitter_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  struct usb_skx *skx = usb_get_intfdata(to_usb_interface(dev));
+
+  return sysfs_emit(buf, "%llu\n", div_u64(READ_ONCE(skx->in_jitter) / 16, NSEC_PER_USEC));
+}
+static DEVICE_ATTR_RO(in_jitter_us);
+
+static ssize_t in_delay_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  struct usb_skx *skx = usb_get_intfdata(to_usb_interface(dev));
+
+  return sysfs_emit(buf, "%lu\n", READ_ONCE(skx->in_delay_ns) / NSEC_PER_USEC);
+}
+
+static ssize_t in_delay_us_store(struct device *dev, struct device_attribute *attr,
+    const char *buf, size_t count)
+{
+  struct usb_skx *skx = usb_get_intfdata(to_usb_interface(dev));
+  unsigned int delay;
+  int err;
+
+  err = kstrtouint(buf, 0, &delay);
+  if (err)
+    return err;
+  if (delay > SKX_IN_DELAY_MAX_US)
+    return -EINVAL;
+
+  WRITE_ONCE(skx->in_delay_ns, delay * NSEC_PER_USEC);
+
+  return count;
+}
+static DEVICE_ATTR_RW(in_delay_us);
+
+static const char * const skx_stick_modes[] = {
+  [SKX_STICK_RAW] = "raw",
+  [SKX_STICK_AXIAL] = "axial",
+  [SKX_STICK_RADIAL] = "radial",
+};
+
+/*
+  Compiles a new stick configuration and swaps it in. The tables are
+  built outside of the input path, which only ever sees a complete set.
+*/
+static int skx_set_curve(struct usb_skx *skx, unsigned int stick,
+    const struct skx_stick_config *config)
+{
+  struct skx_stick_config configs[SKX_STICKS];
+  struct skx_curve_set *set = NULL, *old;
+  unsigned int i;
+
+  mutex_lock(&skx->curve_lock);
+
+  /* Nothing is committed until the tables for it are built */
+  memcpy(configs, skx->stick_config, sizeof(configs));
+  configs[stick] = *config;
+
+  for (i = 0; i < SKX_STICKS; i++) {
+    if (configs[i].mode == SKX_STICK_RAW)
+      continue;
+
+    /* Two 16 KB tables, more than kmalloc() should have to find in one piece */
+    if (!set) {
+      set = kvzalloc(sizeof(*set), GFP_KERNEL);
+      if (!set) {
+        mutex_unlock(&skx->curve_lock);
+        return -ENOMEM;
+      }
+    }
+
+    set->sticks[i].config = configs[i];
+    skx_curve_build(&set->sticks[i]);
   }
 
-  /* Xbox One controller has in/out endpoints swapped. */
-  interrupt_out = &interface->cur_altsetting->endpoint[0].desc;
+  memcpy(skx->stick_config, configs, sizeof(configs));
+  old = rcu_replace_pointer(skx->curves, set, lockdep_is_held(&skx->curve_lock));
 
-  usb_fill_int_urb(skx->interrupt_out, skx->usb_dev,
-       usb_sndintpipe(skx->usb_dev, interrupt_out->bEndpointAddress),
-       skx->output_data, PKT_LEN,
-       skx_interrupt_out, skx, interrupt_out->bInterval);
+  mutex_unlock(&skx->curve_lock);
 
-  skx->interrupt_out->transfer_dma = skx->output_data_dma;
-  skx->interrupt_out->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+  if (old)
+    kvfree_rcu(old, rcu);
+
+  dev_dbg(&skx->interface->dev, "SKX: stick %u now %s, deadzone %u\n",
+      stick, skx_stick_modes[config->mode], config->deadzone);
 
   return 0;
 }
 
-static int skx_init_input(struct usb_skx *skx)
+/* "in:out,in:out,...", ascending in both, up to SKX_CURVE_POINTS points */
+static int skx_parse_curve(char *list, struct skx_stick_config *config)
 {
-  struct input_dev *indev;
-  int i, error;
+  unsigned int in, out, last_in = 0, last_out = 0;
+  char *point;
+
+  config->points = 0;
+
+  while ((point = strsep(&list, ",")) && *point) {
+    if (config->points == SKX_CURVE_POINTS)
+      return -E2BIG;
+    if (sscanf(point, "%u:%u", &in, &out) != 2 || in > SKX_AXIS_MAX || out > SKX_AXIS_MAX ||
+        in < last_in || out < last_out)
+      return -EINVAL;
+
+    config->curve_in[config->points] = in;
+    config->curve_out[config->points] = out;
+    config->points++;
+    last_in = in;
+    last_out = out;
+  }
 
-  indev = input_allocate_device();
-  if (!indev)
+  return 0;
+}
+
+/*
+  Parses "[raw|axial|radial] [deadzone=N] [anti_deadzone=N] [curve=in:out,...]",
+  anything left out keeps its current value.
+*/
+static int skx_parse_stick(char *buf, struct skx_stick_config *config)
+{
+  unsigned int value;
+  char *token, *arg;
+  int mode, err;
+
+  while ((token = strsep(&buf, " \t\n"))) {
+    if (!*token)
+      continue;
+
+    mode = match_string(skx_stick_modes, ARRAY_SIZE(skx_stick_modes), token);
+    if (mode >= 0) {
+      config->mode = mode;
+      continue;
+    }
+
+    arg = strchr(token, '=');
+    if (!arg)
+      return -EINVAL;
+    *arg++ = '\0';
+
+    if (!strcmp(token, "curve")) {
+      err = skx_parse_curve(arg, config);
+      if (err)
+        return err;
+      continue;
+    }
+
+    err = kstrtouint(arg, 0, &value);
+    if (err)
+      return err;
+    if (value >= SKX_AXIS_MAX)
+      return -ERANGE;
+
+    if (!strcmp(token, "deadzone"))
+      config->deadzone = value;
+    else if (!strcmp(token, "anti_deadzone"))
+      config->anti_deadzone = value;
+    else
+      return -EINVAL;
+  }
+
+  return 0;
+}
+
+static ssize_t skx_stick_show(struct usb_skx *skx, unsigned int stick, char *buf)
+{
+  struct skx_stick_config config;
+  unsigned int i;
+  int len;
+
+  mutex_lock(&skx->curve_lock);
+  config = skx->stick_config[stick];
+  mutex_unlock(&skx->curve_lock);
+
+  len = sysfs_emit(buf, "%s deadzone=%u anti_deadzone=%u curve=", skx_stick_modes[config.mode],
+      config.deadzone, config.anti_deadzone);
+  for (i = 0; i < config.points; i++)
+    len += sysfs_emit_at(buf, len, "%s%u:%u", i ? "," : "", config.curve_in[i], config.curve_out[i]);
+  len += sysfs_emit_at(buf, len, "\n");
+
+  return len;
+}
+
+static ssize_t skx_stick_store(struct usb_skx *skx, unsigned int stick, const char *buf,
+    size_t count)
+{
+  struct skx_stick_config config;
+  char *copy;
+  int err;
+
+  copy = kstrndup(buf, count, GFP_KERNEL);
+  if (!copy)
     return -ENOMEM;
+
+  mutex_lock(&skx->curve_lock);
+  config = skx->stick_config[stick];
+  mutex_unlock(&skx->curve_lock);
+
+  err = skx_parse_stick(copy, &config);
+  kfree(copy);
+  if (err)
+    return err;
+
+  err = skx_set_curve(skx, stick, &config);
+
+  return err ? err : count;
+}
+
+static ssize_t left_stick_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  return skx_stick_show(usb_get_intfdata(to_usb_interface(dev)), 0, buf);
+}
+
+static ssize_t left_stick_store(struct device *dev, struct device_attribute *attr,
+    const char *buf, size_t count)
+{
+  return skx_stick_store(usb_get_intfdata(to_usb_interface(dev)), 0, buf, count);
+}
+static DEVICE_ATTR_RW(left_stick);
+
+static ssize_t right_stick_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  return skx_stick_show(usb_get_intfdata(to_usb_interface(dev)), 1, buf);
+}
+
+static ssize_t right_stick_store(struct device *dev, struct device_attribute *attr,
+    const char *buf, size_t count)
+{
+  return skx_stick_store(usb_get_intfdata(to_usb_interface(dev)), 1, buf, count);
+}
+static DEVICE_ATTR_RW(right_stick);
+
+/*
+  Switches to a new remap profile. Capabilities follow the profile, so a
+  new input device is registered in place of the old one, which goes
+  away like an unplugged pad, effects included. The input ring is stopped
+  meanwhile so the decoder never sees keymap and dev out of step. A
+  runtime PM reference is held throughout, or closing the old device
+  could autosuspend the pad from under interval_lock.
+*/
+static int skx_set_keymap(struct usb_skx *skx, const struct skx_keymap *map)
+{
+  struct input_dev *indev, *old;
+  struct skx_keymap old_map;
+  unsigned long flags;
+  bool paused;
+  int err;
+
+  err = usb_autopm_get_interface(skx->interface);
+  if (err)
+    return err;
+
+  mutex_lock(&skx->interval_lock);
+  skx_stop_recovery(skx);
+  usb_kill_anchored_urbs(&skx->interrupt_in_anchor);
+
+  old_map = skx->keymap;
+  skx->keymap = *map;
+
+  indev = skx_alloc_input(skx);
+  if (!indev) {
+    err = -ENOMEM;
+    goto err_restore;
+  }
+
+  /* Whatever the old device was playing stops with it */
+  spin_lock_irqsave(&skx->ff_lock, flags);
+  old = skx->dev;
   skx->dev = indev;
-  indev->name = skx->name;
-  indev->phys = skx->phys_path;
-  usb_to_input_id(skx->usb_dev, &indev->id);
-  indev->dev.parent = &skx->interface->dev;
-  input_set_drvdata(indev, skx);
+  bitmap_zero(skx->ff.active, FF_EFFECTS);
+  skx->ff.gain = 0xFFFF;
+  skx_ff_update(skx, ktime_get());
+  spin_unlock_irqrestore(&skx->ff_lock, flags);
+
+  err = input_register_device(indev);
+  if (err) {
+    spin_lock_irqsave(&skx->ff_lock, flags);
+    skx->dev = old;
+    spin_unlock_irqrestore(&skx->ff_lock, flags);
+    input_free_device(indev);
+    goto err_restore;
+  }
 
+  input_unregister_device(old);
 
-  __set_bit(EV_KEY, indev->evbit);
-  __set_bit(EV_ABS, indev->evbit);
-  for (i = 0; skx_buttons[i] >= 0; i++)
-      __set_bit(skx_buttons[i], indev->keybit);
-  for (i = 0; skx_axis[i] >= 0; i++){
-    set_bit(skx_axis[i], indev->absbit);
-    switch (skx_axis[i]) {
-      case ABS_X:
-      case ABS_Y:
-      case ABS_RX:
-      case ABS_RY:
-        input_set_abs_params(indev, skx_axis[i], -32768, 32767, 16, 128);
-        break;
-      case ABS_Z:
-      case ABS_RZ:
-        input_set_abs_params(indev, skx_axis[i], 0, 1023, 0, 0);
-        break;
-      case ABS_HAT0X:
-      case ABS_HAT0Y:
-        input_set_abs_params(indev, skx_axis[i], -1, 1, 0, 0);
+  /* The new device knows nothing yet, so the next report is emitted in full */
+  memset(skx->last_report, 0, sizeof(skx->last_report));
+
+  dev_dbg(&skx->interface->dev, "SKX: remap profile applied\n");
+  goto out;
+
+err_restore:
+  skx->keymap = old_map;
+out:
+  if (skx_submit_in_ring(skx) && !err)
+    err = -EIO;
+  clear_bit(SKX_ERR_STOPPED, &skx->err_flags);
+
+  /* An OUT error whose recovery was cancelled above still holds the output back */
+  spin_lock_irqsave(&skx->output_data_lock, flags);
+  paused = skx->out.paused;
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+  if (paused)
+    skx_schedule_recovery(skx, skx_err_rounds(skx, ktime_get()));
+
+  mutex_unlock(&skx->interval_lock);
+
+  usb_autopm_put_interface(skx->interface);
+
+  return err;
+}
+
+static const struct skx_code_name *skx_find_code(const char *name)
+{
+  unsigned int i;
+
+  for (i = 0; i < ARRAY_SIZE(skx_code_names); i++)
+    if (!strcmp(skx_code_names[i].name, name))
+      return &skx_code_names[i];
+
+  return NULL;
+}
+
+/* Name of an event, NULL for keys outside the pad's layout */
+static const char *skx_code_name(unsigned int type, unsigned int code)
+{
+  unsigned int i;
+
+  for (i = 0; i < ARRAY_SIZE(skx_code_names); i++)
+    if (skx_code_names[i].type == type && skx_code_names[i].code == code)
+      return skx_code_names[i].name;
+
+  return NULL;
+}
+
+static const char *skx_field_name(const struct skx_report_field *f)
+{
+  return skx_code_name(f->type == SKX_FIELD_KEY ? EV_KEY : EV_ABS, f->code);
+}
+
+/*
+  Parses "SRC=DST ..." into map, starting from the pad's own layout. SRC
+  is an event of that layout; DST is "none", another event of the layout
+  or any key by number, a '-' in front of an axis inverting it.
+*/
+static int skx_parse_keymap(char *buf, struct skx_keymap *map)
+{
+  const struct skx_code_name *dst;
+  unsigned int i, type, code;
+  char *token, *arg;
+  bool invert;
+  int err;
+
+  skx_keymap_reset(map);
+
+  while ((token = strsep(&buf, " \t\n"))) {
+    if (!*token)
+      continue;
+
+    arg = strchr(token, '=');
+    if (!arg)
+      return -EINVAL;
+    *arg++ = '\0';
+
+    for (i = 0; i < SKX_REPORT_FIELDS; i++)
+      if (!strcmp(skx_field_name(&skx_report_fields[i]), token))
         break;
+    if (i == SKX_REPORT_FIELDS)
+      return -EINVAL;
+
+    invert = *arg == '-';
+    if (invert)
+      arg++;
+
+    if (!strcmp(arg, "none")) {
+      if (invert)
+        return -EINVAL;
+      type = 0;
+      code = 0;
+    } else if ((dst = skx_find_code(arg))) {
+      type = dst->type;
+      code = dst->code;
+    } else {
+      err = kstrtouint(arg, 0, &code);
+      if (err)
+        return err;
+      if (!code || code > KEY_MAX)
+        return -ERANGE;
+      type = EV_KEY;
     }
-  }
 
-  error = input_register_device(skx->dev);
-  if (error)
-  {
-    //input_ff_destroy(indev);
-    input_free_device(indev);
-    return error;
+    err = skx_keymap_set(map, i, type, code, invert);
+    if (err)
+      return err;
   }
 
   return 0;
 }
 
-static int skx_start_input(struct usb_skx *skx)
+static ssize_t remap_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
-  int error;
-  static const u8 init_pkt_1[] = {
-    0x01, 0x20, 0x00, 0x09, 0x00,
-    0x04, 0x20, 0x3a, 0x00, 0x00,
-    0x00, 0x80, 0x00
-  };
-  static const u8 init_pkt_2[] = {0x05, 0x20, 0x00, 0x01, 0x00};
-  struct output_packet *packet =
-      &skx->out_packets[0];
+  struct usb_skx *skx = usb_get_intfdata(to_usb_interface(dev));
+  const struct skx_report_field *src, *f;
+  struct skx_keymap map;
+  const char *name;
+  unsigned int i;
+  bool invert;
+  int len = 0;
+
+  mutex_lock(&skx->interval_lock);
+  map = skx->keymap;
+  mutex_unlock(&skx->interval_lock);
+
+  /* Only what differs from the pad's own layout */
+  for (i = 0; i < SKX_REPORT_FIELDS; i++) {
+    src = &skx_report_fields[i];
+    f = &map.field[i];
+    if (!memcmp(f, src, sizeof(*f)))
+      continue;
+
+    len += sysfs_emit_at(buf, len, "%s%s=", len ? " " : "", skx_field_name(src));
+
+    if (f->type == SKX_FIELD_NONE) {
+      len += sysfs_emit_at(buf, len, "none");
+      continue;
+    }
+
+    if (f->type == SKX_FIELD_KEY_ABS)
+      invert = f->value <= 0;
+    else
+      invert = f->type != src->type || f->mask != src->mask;
+
+    name = skx_field_name(f);
+    if (name)
+      len += sysfs_emit_at(buf, len, "%s%s", invert ? "-" : "", name);
+    else
+      len += sysfs_emit_at(buf, len, "%u", f->code);
+  }
+  len += sysfs_emit_at(buf, len, "\n");
+
+  return len;
+}
+
+static ssize_t remap_store(struct device *dev, struct device_attribute *attr,
+    const char *buf, size_t count)
+{
+  struct usb_skx *skx = usb_get_intfdata(to_usb_interface(dev));
+  struct skx_keymap map;
+  char *copy;
+  int err;
+
+  copy = kstrndup(buf, count, GFP_KERNEL);
+  if (!copy)
+    return -ENOMEM;
+
+  err = skx_parse_keymap(copy, &map);
+  kfree(copy);
+  if (err)
+    return err;
+
+  err = skx_set_keymap(skx, &map);
+
+  return err ? err : count;
+}
+static DEVICE_ATTR_RW(remap);
+
+static ssize_t first_report_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  struct usb_skx *skx = usb_get_intfdata(to_usb_interface(dev));
+
+  return sysfs_emit(buf, "%u\n", READ_ONCE(skx->first_report_us));
+}
+static DEVICE_ATTR_RO(first_report_us);
+
+static ssize_t in_urbs_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  struct usb_skx *skx = usb_get_intfdata(to_usb_interface(dev));
+
+  return sysfs_emit(buf, "%u\n", skx->num_in_urbs);
+}
+static DEVICE_ATTR_RO(in_urbs);
+
+static ssize_t in_ring_dry_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  struct usb_skx *skx = usb_get_intfdata(to_usb_interface(dev));
+
+  return sysfs_emit(buf, "%d\n", atomic_read(&skx->in_ring_dry));
+}
+static DEVICE_ATTR_RO(in_ring_dry);
+
+static ssize_t in_resubmit_failed_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  struct usb_skx *skx = usb_get_intfdata(to_usb_interface(dev));
+
+  return sysfs_emit(buf, "%d\n", atomic_read(&skx->in_resubmit_failed));
+}
+static DEVICE_ATTR_RO(in_resubmit_failed);
+
+static struct attribute *skx_attrs[] = {
+  &dev_attr_in_urbs.attr,
+  &dev_attr_in_ring_dry.attr,
+  &dev_attr_in_resubmit_failed.attr,
+  &dev_attr_in_interval.attr,
+  &dev_attr_out_interval.attr,
+  &dev_attr_in_rate.attr,
+  &dev_attr_in_jitter_us.attr,
+  &dev_attr_in_delay_us.attr,
+  &dev_attr_first_report_us.attr,
+  &dev_attr_left_stick.attr,
+  &dev_attr_right_stick.attr,
+  &dev_attr_remap.attr,
+  NULL
+};
+ATTRIBUTE_GROUPS(skx);
+
+static void skx_read_stats(struct usb_skx *skx, struct skx_pcpu_stats *sum)
+{
+  u64 *dst = (u64 *)sum;
+  const u64 *src;
+  unsigned int i;
+  int cpu;
+
+  memset(sum, 0, sizeof(*sum));
+
+  for_each_possible_cpu(cpu) {
+    src = (const u64 *)per_cpu_ptr(skx->stats, cpu);
+    for (i = 0; i < sizeof(*sum) / sizeof(u64); i++)
+      dst[i] += src[i];
+  }
+}
+
+static void skx_show_errors(struct seq_file *s, const char *dir, const u64 *errors)
+{
+  unsigned int i;
+
+  for (i = 0; i < ARRAY_SIZE(skx_urb_statuses); i++)
+    seq_printf(s, "%s_urb_errors.%s: %llu\n", dir, skx_urb_statuses[i].name, errors[i]);
+  seq_printf(s, "%s_urb_errors.other: %llu\n", dir, errors[i]);
+}
+
+static int skx_debugfs_stats_show(struct seq_file *s, void *unused)
+{
+  struct usb_skx *skx = s->private;
+  struct skx_pcpu_stats *sum;
   unsigned long flags;
+  unsigned int hwm;
 
-  if (usb_submit_urb(skx->interrupt_in, GFP_KERNEL))
-    return -EIO;
+  sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+  if (!sum)
+    return -ENOMEM;
 
-  
+  skx_read_stats(skx, sum);
 
   spin_lock_irqsave(&skx->output_data_lock, flags);
+  hwm = skx->out_queue_hwm;
+  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+
+  seq_printf(s, "reports.0x02: %llu\n", sum->reports[SKX_STAT_REPORT_02]);
+  seq_printf(s, "reports.0x03: %llu\n", sum->reports[SKX_STAT_REPORT_03]);
+  seq_printf(s, "reports.0x04: %llu\n", sum->reports[SKX_STAT_REPORT_04]);
+  seq_printf(s, "reports.0x07: %llu\n", sum->reports[SKX_STAT_REPORT_07]);
+  seq_printf(s, "reports.0x20: %llu\n", sum->reports[SKX_STAT_REPORT_20]);
+  seq_printf(s, "reports.other: %llu\n", sum->reports[SKX_STAT_REPORT_OTHER]);
+  seq_printf(s, "gip_acks: %llu\n", sum->gip_acks);
+  seq_printf(s, "gip_malformed: %llu\n", sum->gip_malformed);
+  seq_printf(s, "gip_chunk_errors: %llu\n", sum->gip_chunk_errors);
+  if (READ_ONCE(skx->gip_status_at))
+    seq_printf(s, "status: 0x%02x, %lld ms ago\n", READ_ONCE(skx->gip_status),
+        ktime_ms_delta(ktime_get(), READ_ONCE(skx->gip_status_at)));
+  skx_show_errors(s, "in", sum->in_urb_errors);
+  seq_printf(s, "in_ring_dry: %d\n", atomic_read(&skx->in_ring_dry));
+  seq_printf(s, "in_resubmit_failed: %d\n", atomic_read(&skx->in_resubmit_failed));
+  skx_show_errors(s, "out", sum->out_urb_errors);
+  seq_printf(s, "out_packets: %llu\n", sum->out_packets);
+  seq_printf(s, "out_dropped: %llu\n", sum->out_dropped);
+  seq_printf(s, "out_queue_hwm: %u\n", hwm);
+  seq_printf(s, "urb_recoveries: %llu\n", sum->urb_recoveries);
+  seq_printf(s, "urb_halts_cleared: %llu\n", sum->urb_halts_cleared);
+  seq_printf(s, "urb_resets: %llu\n", sum->urb_resets);
+  seq_printf(s, "ff_requests: %llu\n", sum->ff_requests);
+  seq_printf(s, "ff_overwritten: %llu\n", sum->ff_overwritten);
+
+  kfree(sum);
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(skx_debugfs_stats);
 
-  WARN_ON_ONCE(packet->is_pending);
+static void skx_show_hist(struct seq_file *s, const char *name, const u64 *hist)
+{
+  unsigned int i;
+
+  seq_printf(s, "%s:\n", name);
+  for (i = 0; i < SKX_HIST_BUCKETS; i++) {
+    if (!hist[i])
+      continue;
+    if (i == SKX_HIST_BUCKETS - 1)
+      seq_printf(s, "  >= %10llu ns: %llu\n", 1ULL << (i - 1), hist[i]);
+    else
+      seq_printf(s, "  < %11llu ns: %llu\n", 1ULL << i, hist[i]);
+  }
+}
 
-  memcpy(packet->data, init_pkt_1, sizeof(init_pkt_1));
-  packet->data[2] = skx->data_serial++;
-  packet->len = sizeof(init_pkt_1);
-  packet->is_pending = true;
+static int skx_debugfs_latency_show(struct seq_file *s, void *unused)
+{
+  struct usb_skx *skx = s->private;
+  struct skx_pcpu_stats *sum;
 
-  skx->last_out_packet = -1;
-  error = skx_send_packet(skx);
+  sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+  if (!sum)
+    return -ENOMEM;
 
-  if (error) {
-    usb_kill_urb(skx->interrupt_in);
-    return error;
+  skx_read_stats(skx, sum);
+
+  skx_show_hist(s, "completion_to_sync", sum->sync_latency);
+  skx_show_hist(s, "ff_to_out_complete", sum->ff_latency);
+
+  kfree(sum);
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(skx_debugfs_latency);
+
+static ssize_t skx_capture_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos)
+{
+  struct usb_skx *skx = file->private_data;
+  char buf[3];
+
+  snprintf(buf, sizeof(buf), "%c\n", READ_ONCE(skx->capture_on) ? 'Y' : 'N');
+
+  return simple_read_from_buffer(ubuf, count, ppos, buf, 2);
+}
+
+/*
+  Switching capture on starts a new capture; the ring itself is only
+  allocated the first time.
+*/
+static ssize_t skx_capture_write(struct file *file, const char __user *ubuf, size_t count,
+    loff_t *ppos)
+{
+  struct usb_skx *skx = file->private_data;
+  bool enable;
+  int err;
+
+  err = kstrtobool_from_user(ubuf, count, &enable);
+  if (err)
+    return err;
+
+  mutex_lock(&skx->capture_lock);
+
+  if (enable && !skx->capture_on) {
+    if (!skx->capture)
+      skx->capture = vzalloc(sizeof(*skx->capture));
+    if (!skx->capture) {
+      err = -ENOMEM;
+      goto out;
+    }
+    /* Nothing would be captured from an autosuspended pad */
+    err = usb_autopm_get_interface(skx->interface);
+    if (err)
+      goto out;
+    skx->capture->start = atomic_read(&skx->capture->head);
+    smp_store_release(&skx->capture_on, true);
+    static_branch_inc(&skx_capture_key);
+  } else if (!enable && skx->capture_on) {
+    WRITE_ONCE(skx->capture_on, false);
+    static_branch_dec(&skx_capture_key);
+    usb_autopm_put_interface(skx->interface);
   }
 
-  WARN_ON_ONCE(packet->is_pending);
+out:
+  mutex_unlock(&skx->capture_lock);
+  return err ? err : count;
+}
 
-  memcpy(packet->data, init_pkt_2, sizeof(init_pkt_2));
-  packet->data[2] = skx->data_serial++;
-  packet->len = sizeof(init_pkt_2);
-  packet->is_pending = true;
+static const struct file_operations skx_debugfs_capture_fops = {
+  .owner = THIS_MODULE,
+  .open = simple_open,
+  .read = skx_capture_read,
+  .write = skx_capture_write,
+  .llseek = default_llseek,
+};
 
-  skx->last_out_packet = -1;
-  error = skx_send_packet(skx);
+/* Appends one record in pcap form, returns its size */
+static size_t skx_pcap_record(struct usb_skx *skx, const struct skx_capture_rec *rec, u8 *out)
+{
+  struct skx_pcap_rec_hdr *ph = (struct skx_pcap_rec_hdr *)out;
+  struct skx_usbmon_hdr *mh = (struct skx_usbmon_hdr *)(ph + 1);
+  struct timespec64 ts = ktime_to_timespec64(ktime_mono_to_real(rec->ts));
+
+  BUILD_BUG_ON(sizeof(*mh) != 64);
+
+  ph->ts_sec = ts.tv_sec;
+  ph->ts_nsec = ts.tv_nsec;
+  ph->incl_len = sizeof(*mh) + rec->len;
+  ph->orig_len = ph->incl_len;
+
+  memset(mh, 0, sizeof(*mh));
+  mh->id = rec->seq - 1;
+  mh->type = 'C';
+  mh->xfer_type = 1;
+  mh->epnum = rec->ep;
+  mh->devnum = skx->usb_dev->devnum;
+  mh->busnum = skx->usb_dev->bus->busnum;
+  mh->flag_setup = '-';
+  mh->flag_data = rec->len ? 0 : '<';
+  mh->ts_sec = ts.tv_sec;
+  mh->ts_usec = ts.tv_nsec / NSEC_PER_USEC;
+  mh->status = rec->status;
+  mh->len_urb = rec->len;
+  mh->len_cap = rec->len;
+  mh->interval = rec->interval;
+
+  memcpy(mh + 1, rec->data, rec->len);
+
+  return sizeof(*ph) + ph->incl_len;
+}
 
-  if (error) {
-    usb_kill_urb(skx->interrupt_in);
-    return error;
+/*
+  Opening capture.pcap takes a snapshot of the ring as it is, which reads
+  of that file then return. Records reused while they were copied are
+  left out.
+*/
+static int skx_pcap_open(struct inode *inode, struct file *file)
+{
+  struct usb_skx *skx = inode->i_private;
+  struct skx_pcap_snapshot *snap;
+  struct skx_pcap_file_hdr *fh;
+  struct skx_capture_rec rec;
+  const struct skx_capture_rec *slot;
+  struct skx_capture *cap;
+  u32 start, head, n;
+  size_t len;
+
+  snap = vmalloc(sizeof(*snap) + sizeof(*fh) + SKX_CAPTURE_SLOTS * SKX_PCAP_REC_MAX);
+  if (!snap)
+    return -ENOMEM;
+
+  fh = (struct skx_pcap_file_hdr *)snap->data;
+  fh->magic = SKX_PCAP_MAGIC_NS;
+  fh->version_major = 2;
+  fh->version_minor = 4;
+  fh->thiszone = 0;
+  fh->sigfigs = 0;
+  fh->snaplen = SKX_PCAP_REC_MAX;
+  fh->linktype = SKX_PCAP_LINKTYPE_USB_LINUX_MMAPPED;
+  len = sizeof(*fh);
+
+  mutex_lock(&skx->capture_lock);
+  cap = skx->capture;
+  if (cap) {
+    start = cap->start;
+    head = atomic_read(&cap->head);
+    if (head - start > SKX_CAPTURE_SLOTS)
+      start = head - SKX_CAPTURE_SLOTS;
+
+    for (n = start; n != head; n++) {
+      slot = &cap->rec[n % SKX_CAPTURE_SLOTS];
+      if (smp_load_acquire(&slot->seq) != n + 1)
+        continue;
+      rec = *slot;
+      smp_rmb();
+      if (READ_ONCE(slot->seq) != n + 1)
+        continue;
+
+      len += skx_pcap_record(skx, &rec, snap->data + len);
+    }
   }
+  mutex_unlock(&skx->capture_lock);
 
-  spin_unlock_irqrestore(&skx->output_data_lock, flags);
+  snap->len = len;
+  file->private_data = snap;
+
+  return 0;
+}
+
+static ssize_t skx_pcap_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos)
+{
+  struct skx_pcap_snapshot *snap = file->private_data;
+
+  return simple_read_from_buffer(ubuf, count, ppos, snap->data, snap->len);
+}
 
+static int skx_pcap_release(struct inode *inode, struct file *file)
+{
+  vfree(file->private_data);
   return 0;
 }
 
+static const struct file_operations skx_debugfs_pcap_fops = {
+  .owner = THIS_MODULE,
+  .open = skx_pcap_open,
+  .read = skx_pcap_read,
+  .release = skx_pcap_release,
+  .llseek = default_llseek,
+};
+
+static void skx_init_debugfs(struct usb_skx *skx)
+{
+  skx->debugfs = debugfs_create_dir(dev_name(&skx->interface->dev), skx_debugfs_root);
+  debugfs_create_file("stats", 0444, skx->debugfs, skx, &skx_debugfs_stats_fops);
+  debugfs_create_file("latency", 0444, skx->debugfs, skx, &skx_debugfs_latency_fops);
+  debugfs_create_file("capture", 0600, skx->debugfs, skx, &skx_debugfs_capture_fops);
+  debugfs_create_file("capture.pcap", 0400, skx->debugfs, skx, &skx_debugfs_pcap_fops);
+}
+
 static struct usb_driver skx_driver = {
   .name   = "skx",
   .probe    = skx_probe,
   .disconnect = skx_disconnect,
+  .suspend = skx_suspend,
+  .resume = skx_resume,
+  .reset_resume = skx_resume,
+  .pre_reset = skx_pre_reset,
+  .post_reset = skx_resume,
+  .supports_autosuspend = 1,
   .id_table = skx_table,
+  .dev_groups = skx_groups,
 };
 
-module_usb_driver(skx_driver);
+static int __init skx_init(void)
+{
+  int err;
+
+  skx_debugfs_root = debugfs_create_dir("skx", NULL);
+
+  err = usb_register(&skx_driver);
+  if (err)
+    debugfs_remove_recursive(skx_debugfs_root);
+
+  return err;
+}
+
+static void __exit skx_exit(void)
+{
+  usb_deregister(&skx_driver);
+  debugfs_remove_recursive(skx_debugfs_root);
+}
+
+module_init(skx_init);
+module_exit(skx_exit);
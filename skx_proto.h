@@ -0,0 +1,1392 @@
+#ifndef SKX_PROTO_H
+#define SKX_PROTO_H
+
+/*
+  Report decoding, force feedback rendering and the output state machine.
+  Nothing in here touches USB, the input core or locking, so the same code
+  builds into the module, into its KUnit suite (skx_proto_test.c) and into
+  the userspace benchmark in tools/skx_bench, which provides the handful
+  of kernel helpers used below before including this file.
+*/
+
+#ifdef __KERNEL__
+#include <asm/barrier.h>
+#include <linux/bitops.h>
+#include <linux/compiler.h>
+#include <linux/fixp-arith.h>
+#include <linux/input.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+#endif
+
+#include "skx_raw.h"
+
+#define PKT_LEN 64
+#define REPORT_LEN 18
+#define RUMBLE_LEN 13
+#define ACK_LEN 13
+#define OUT_QUEUE_LEN 8
+#define FF_EFFECTS 16
+#define FF_REFRESH_MS 2000
+#define MOTOR_MAX 0x64
+#define SKX_FF_VELOCITY_MS 100        /* full stick travel in this long is full velocity */
+#define SKX_FF_VELOCITY_GAP_MS 50     /* reports further apart don't give a velocity */
+#define SKX_FF_CONDITION_STEP (0x7FFF / MOTOR_MAX)
+
+/*
+  GIP messages start with command, options, sequence and the payload
+  length as a varint. Chunked messages add the chunk's offset as another
+  varint; the first chunk carries the whole message's length there
+  instead.
+*/
+#define GIP_MSG_MAX 1024
+#define GIP_OPT_CLIENT 0x0F
+#define GIP_OPT_ACK 0x10        /* the pad wants an ack */
+#define GIP_OPT_INTERNAL 0x20
+#define GIP_OPT_CHUNK_START 0x40
+#define GIP_OPT_CHUNK 0x80
+
+enum skx_gip_command {
+  GIP_CMD_ACK = 0x01,
+  GIP_CMD_ANNOUNCE = 0x02,
+  GIP_CMD_STATUS = 0x03,
+  GIP_CMD_IDENTIFY = 0x04,
+  GIP_CMD_POWER = 0x05,
+  GIP_CMD_GUIDE = 0x07,
+  GIP_CMD_RUMBLE = 0x09,
+  GIP_CMD_INPUT = 0x20,
+};
+
+struct skx_gip_header {
+  u8 command;
+  u8 options;
+  u8 sequence;
+  u8 size;            /* of the header, 0 for a reassembled message */
+  u32 length;         /* of the payload that follows */
+  u32 chunk_offset;
+};
+
+/* A message being reassembled from its chunks */
+struct skx_gip_msg {
+  u8 data[GIP_MSG_MAX];
+  u32 total;
+  u32 received;
+  u8 command;
+  bool active;
+};
+
+static inline bool skx_gip_varint(const u8 *data, unsigned int len, unsigned int *pos, u32 *value)
+{
+  unsigned int shift;
+
+  *value = 0;
+  for (shift = 0; shift < 28 && *pos < len; shift += 7) {
+    *value |= (u32)(data[*pos] & 0x7F) << shift;
+    if (!(data[(*pos)++] & 0x80))
+      return true;
+  }
+
+  return false;
+}
+
+/* Parses the header of the len bytes at data, false if they can't hold the message */
+static inline bool skx_gip_parse(const u8 *data, unsigned int len, struct skx_gip_header *hdr)
+{
+  unsigned int pos = 3;
+
+  if (len < 4)
+    return false;
+
+  hdr->command = data[0];
+  hdr->options = data[1];
+  hdr->sequence = data[2];
+  hdr->chunk_offset = 0;
+
+  if (!skx_gip_varint(data, len, &pos, &hdr->length))
+    return false;
+  if ((hdr->options & GIP_OPT_CHUNK) && !skx_gip_varint(data, len, &pos, &hdr->chunk_offset))
+    return false;
+
+  hdr->size = pos;
+
+  return pos + hdr->length <= len;
+}
+
+/*
+  Copies one chunk's payload into msg. *received is how far into the
+  message the chunk reaches, for the ack. Returns the message's length
+  once this chunk completed it, 0 if there is more to come (or for the
+  empty chunk that closes a message), or a negative error if the message
+  had to be dropped.
+*/
+static inline int skx_gip_chunk(struct skx_gip_msg *msg, const struct skx_gip_header *hdr,
+    const u8 *payload, u32 *received)
+{
+  u32 offset = hdr->chunk_offset;
+
+  if (hdr->options & GIP_OPT_CHUNK_START) {
+    msg->active = offset <= GIP_MSG_MAX;
+    if (!msg->active)
+      return -E2BIG;
+
+    msg->command = hdr->command;
+    msg->total = offset;
+    msg->received = 0;
+    offset = 0;
+  }
+
+  *received = offset + hdr->length;
+
+  if (!hdr->length)
+    return 0;
+
+  if (!msg->active || msg->command != hdr->command || *received > msg->total) {
+    msg->active = false;
+    return -EPROTO;
+  }
+
+  memcpy(msg->data + offset, payload, hdr->length);
+  msg->received = max(msg->received, *received);
+  if (msg->received < msg->total)
+    return 0;
+
+  msg->active = false;
+  return msg->total;
+}
+
+/* Builds the ack of a message, or of a chunk of one */
+static inline u8 skx_build_ack(u8 *data, const struct skx_gip_header *hdr, u16 received,
+    u16 remaining)
+{
+  data[0] = GIP_CMD_ACK;
+  data[1] = GIP_OPT_INTERNAL;
+  data[2] = hdr->sequence;  // Acks echo the pad's sequence
+  data[3] = 0x09;
+  data[4] = 0x00;
+  data[5] = hdr->command;
+  data[6] = (hdr->options & GIP_OPT_CLIENT) | GIP_OPT_INTERNAL;
+  data[7] = received & 0xFF; // Bytes of the message received so far
+  data[8] = received >> 8;
+  data[9] = 0x00;
+  data[10] = 0x00;
+  data[11] = remaining & 0xFF; // Bytes still to come
+  data[12] = remaining >> 8;
+
+  return ACK_LEN;
+}
+
+#define SKX_AXIS_MAX 0x7FFF
+#define SKX_TRIGGER_MAX 1023
+
+enum skx_field_type {
+  SKX_FIELD_KEY,      /* one bit */
+  SKX_FIELD_HAT,      /* mask is the positive direction, mask_neg the negative */
+  SKX_FIELD_U16,      /* little endian word */
+  SKX_FIELD_S16,      /* little endian signed word */
+  SKX_FIELD_S16_INV,  /* little endian signed word, inverted */
+  SKX_FIELD_U16_INV,  /* little endian word, inverted within 0..SKX_TRIGGER_MAX */
+  SKX_FIELD_KEY_ABS,  /* one bit driving an axis: value while set, 0 while clear */
+  SKX_FIELD_NONE,     /* left out */
+};
+
+struct skx_report_field {
+  u8 type;
+  u8 offset;
+  u8 mask;
+  u8 mask_neg;
+  u16 code;
+  s16 value;
+};
+
+/*
+  Layout of the 0x20 input report, in the order the events are emitted.
+*/
+static const struct skx_report_field skx_report_fields[] = {
+  { SKX_FIELD_KEY, 4, 0x04, 0, BTN_START },
+  { SKX_FIELD_KEY, 4, 0x08, 0, BTN_SELECT },
+
+  /* buttons A,B,X,Y */
+  { SKX_FIELD_KEY, 4, 0x10, 0, BTN_A },
+  { SKX_FIELD_KEY, 4, 0x20, 0, BTN_B },
+  { SKX_FIELD_KEY, 4, 0x40, 0, BTN_X },
+  { SKX_FIELD_KEY, 4, 0x80, 0, BTN_Y },
+
+  /* DPAD Axis */
+  { SKX_FIELD_HAT, 5, 0x08, 0x04, ABS_HAT0X },
+  { SKX_FIELD_HAT, 5, 0x02, 0x01, ABS_HAT0Y },
+
+  /* Stick Press Buttons */
+  { SKX_FIELD_KEY, 5, 0x40, 0, BTN_THUMBL },
+  { SKX_FIELD_KEY, 5, 0x80, 0, BTN_THUMBR },
+
+  /* Bumpers */
+  { SKX_FIELD_KEY, 5, 0x10, 0, BTN_TL },
+  { SKX_FIELD_KEY, 5, 0x20, 0, BTN_TR },
+
+  /* Triggers */
+  { SKX_FIELD_U16, 6, 0, 0, ABS_Z },
+  { SKX_FIELD_U16, 8, 0, 0, ABS_RZ },
+
+  /* Left Stick */
+  { SKX_FIELD_S16, 10, 0, 0, ABS_X },
+  { SKX_FIELD_S16_INV, 12, 0, 0, ABS_Y },
+
+  /* Right Stick */
+  { SKX_FIELD_S16, 14, 0, 0, ABS_RX },
+  { SKX_FIELD_S16_INV, 16, 0, 0, ABS_RY },
+};
+#define SKX_REPORT_FIELDS ARRAY_SIZE(skx_report_fields)
+
+/*
+  A remap profile compiled into the table the decoder walks in place of
+  skx_report_fields, entry for entry, so a remapped report is decoded in
+  the same single pass as the pad's own layout.
+*/
+struct skx_keymap {
+  struct skx_report_field field[SKX_REPORT_FIELDS];
+};
+
+enum skx_axis_class {
+  SKX_AXIS_NONE,
+  SKX_AXIS_STICK,
+  SKX_AXIS_TRIGGER,
+  SKX_AXIS_HAT
+};
+
+static inline enum skx_axis_class skx_axis_class(unsigned int code)
+{
+  switch (code) {
+  case ABS_X:
+  case ABS_Y:
+  case ABS_RX:
+  case ABS_RY:
+    return SKX_AXIS_STICK;
+  case ABS_Z:
+  case ABS_RZ:
+    return SKX_AXIS_TRIGGER;
+  case ABS_HAT0X:
+  case ABS_HAT0Y:
+    return SKX_AXIS_HAT;
+  default:
+    return SKX_AXIS_NONE;
+  }
+}
+
+static inline void skx_keymap_reset(struct skx_keymap *map)
+{
+  memcpy(map->field, skx_report_fields, sizeof(map->field));
+}
+
+/*
+  Points entry i of map at another event: a button at another key, or
+  at an axis it then holds at its end (its start when invert) while
+  pressed; an axis at another of the same kind, inverted or not. A type
+  of 0 leaves the entry out.
+*/
+static inline int skx_keymap_set(struct skx_keymap *map, unsigned int i, unsigned int type,
+    unsigned int code, bool invert)
+{
+  const struct skx_report_field *src = &skx_report_fields[i];
+  struct skx_report_field *f = &map->field[i];
+  enum skx_axis_class cls = skx_axis_class(code);
+
+  if (!type) {
+    *f = *src;
+    f->type = SKX_FIELD_NONE;
+    return 0;
+  }
+
+  if (type == EV_KEY) {
+    if (src->type != SKX_FIELD_KEY || invert)
+      return -EINVAL;
+  } else if (cls == SKX_AXIS_NONE ||
+             (src->type != SKX_FIELD_KEY && cls != skx_axis_class(src->code))) {
+    return -EINVAL;
+  }
+
+  *f = *src;
+  f->code = code;
+
+  if (src->type == SKX_FIELD_KEY) {
+    if (type == EV_KEY)
+      return 0;
+    f->type = SKX_FIELD_KEY_ABS;
+    if (cls == SKX_AXIS_STICK)
+      f->value = invert ? -SKX_AXIS_MAX - 1 : SKX_AXIS_MAX;
+    else if (cls == SKX_AXIS_TRIGGER)
+      f->value = invert ? 0 : SKX_TRIGGER_MAX;
+    else
+      f->value = invert ? -1 : 1;
+    return 0;
+  }
+
+  if (!invert)
+    return 0;
+
+  switch (src->type) {
+  case SKX_FIELD_HAT:
+    f->mask = src->mask_neg;
+    f->mask_neg = src->mask;
+    break;
+  case SKX_FIELD_U16:
+    f->type = SKX_FIELD_U16_INV;
+    break;
+  case SKX_FIELD_S16:
+    f->type = SKX_FIELD_S16_INV;
+    break;
+  case SKX_FIELD_S16_INV:
+    f->type = SKX_FIELD_S16;
+    break;
+  }
+
+  return 0;
+}
+
+/*
+  Walks a 0x20 report against the previous one in prev, calls emit() for
+  every field of fields (skx_report_fields or a keymap's) whose bytes
+  changed, then makes data the new prev. Axes whose bytes did not change
+  are still passed, with changed false, so the caller can catch up with
+  values a fuzz filter held back. Always inlined so emit() ends up as a
+  direct call.
+*/
+static __always_inline void skx_decode_fields(u8 *prev, const u8 *data,
+    const struct skx_report_field *fields,
+    void (*emit)(void *ctx, unsigned int type, unsigned int code, int value, bool changed),
+    void *ctx)
+{
+  const struct skx_report_field *f;
+  u8 diff;
+  int value;
+
+  for (f = fields; f < fields + SKX_REPORT_FIELDS; f++) {
+    switch (f->type) {
+    case SKX_FIELD_NONE:
+      continue;
+
+    case SKX_FIELD_KEY:
+      if (!((data[f->offset] ^ prev[f->offset]) & f->mask))
+        continue;
+      emit(ctx, EV_KEY, f->code, !!(data[f->offset] & f->mask), true);
+      break;
+
+    case SKX_FIELD_KEY_ABS:
+      if (!((data[f->offset] ^ prev[f->offset]) & f->mask))
+        continue;
+      emit(ctx, EV_ABS, f->code, data[f->offset] & f->mask ? f->value : 0, true);
+      break;
+
+    case SKX_FIELD_HAT:
+      if (!((data[f->offset] ^ prev[f->offset]) & (f->mask | f->mask_neg)))
+        continue;
+      emit(ctx, EV_ABS, f->code,
+           !!(data[f->offset] & f->mask) - !!(data[f->offset] & f->mask_neg), true);
+      break;
+
+    default:
+      diff = (data[f->offset] ^ prev[f->offset]) | (data[f->offset + 1] ^ prev[f->offset + 1]);
+
+      value = le16_to_cpup((__le16 *)(data + f->offset));
+      if (f->type == SKX_FIELD_S16)
+        value = (__s16) value;
+      else if (f->type == SKX_FIELD_S16_INV)
+        value = ~(__s16) value;
+      else if (f->type == SKX_FIELD_U16_INV)
+        value = SKX_TRIGGER_MAX - min(value, SKX_TRIGGER_MAX);
+
+      emit(ctx, EV_ABS, f->code, value, diff);
+      break;
+    }
+  }
+
+  memcpy(prev, data, REPORT_LEN);
+}
+
+/*
+  Stick response: a deadzone, an anti-deadzone (the smallest output once
+  outside the deadzone, to get past a game's own) and a piecewise linear
+  curve in between, all on magnitudes 0..SKX_AXIS_MAX. Axial shapes each
+  axis on its own, radial shapes the stick's distance from centre and
+  keeps its direction.
+*/
+#define SKX_STICKS 2
+#define SKX_CURVE_POINTS 8
+#define SKX_CURVE_ENTRIES 4096
+#define SKX_CURVE_SHIFT 3          /* axial tables are indexed by |value| >> 3 */
+#define SKX_CURVE_RADIAL_SHIFT 19  /* radial ones by (x * x + y * y) >> 19 */
+
+enum skx_stick_mode {
+  SKX_STICK_RAW,
+  SKX_STICK_AXIAL,
+  SKX_STICK_RADIAL
+};
+
+struct skx_stick_config {
+  u8 mode;
+  u8 points;
+  u16 deadzone;       /* < SKX_AXIS_MAX */
+  u16 anti_deadzone;  /* < SKX_AXIS_MAX */
+  u16 curve_in[SKX_CURVE_POINTS];   /* ascending, (0,0) and the maximum are implied */
+  u16 curve_out[SKX_CURVE_POINTS];
+};
+
+/*
+  A stick's configuration compiled into a table. Axial entries are the
+  output magnitude for the bottom of their bucket, radial ones the gain
+  (1 << 16 being 1) to apply to both axes.
+*/
+struct skx_stick_curve {
+  struct skx_stick_config config;
+  u32 lut[SKX_CURVE_ENTRIES];
+};
+
+/* Offset of each stick's X word in the 0x20 report, Y follows it */
+static const u8 skx_stick_offsets[SKX_STICKS] = { 10, 14 };
+
+static inline u32 skx_curve_eval(const struct skx_stick_config *c, u32 m)
+{
+  u32 x0 = 0, y0 = 0, x1 = SKX_AXIS_MAX, y1 = SKX_AXIS_MAX;
+  unsigned int i;
+
+  if (m <= c->deadzone)
+    return 0;
+
+  m = (m - c->deadzone) * SKX_AXIS_MAX / (SKX_AXIS_MAX - c->deadzone);
+
+  for (i = 0; i < c->points; i++) {
+    x1 = c->curve_in[i];
+    y1 = c->curve_out[i];
+    if (m <= x1)
+      break;
+    x0 = x1;
+    y0 = y1;
+    x1 = y1 = SKX_AXIS_MAX;
+  }
+
+  if (x1 > x0)
+    m = y0 + ((s32)y1 - (s32)y0) * (s32)(m - x0) / (s32)(x1 - x0);
+  else
+    m = y1;
+
+  return c->anti_deadzone + m * (SKX_AXIS_MAX - c->anti_deadzone) / SKX_AXIS_MAX;
+}
+
+/* Compiles curve->config into curve->lut, done once per configuration */
+static inline void skx_curve_build(struct skx_stick_curve *curve)
+{
+  const struct skx_stick_config *c = &curve->config;
+  u32 i, m, r;
+
+  for (i = 0; i < SKX_CURVE_ENTRIES; i++) {
+    if (c->mode == SKX_STICK_AXIAL) {
+      m = i == SKX_CURVE_ENTRIES - 1 ? SKX_AXIS_MAX : i << SKX_CURVE_SHIFT;
+      curve->lut[i] = skx_curve_eval(c, m);
+    } else {
+      /* Past full deflection (the square's corners) the gain stays as it is there */
+      r = min_t(u32, int_sqrt((unsigned long)i << SKX_CURVE_RADIAL_SHIFT), SKX_AXIS_MAX);
+      curve->lut[i] = r ? div_u64((u64)skx_curve_eval(c, r) << 16, r) : 0;
+    }
+  }
+}
+
+static inline s32 skx_curve_axis(const struct skx_stick_curve *curve, s32 v)
+{
+  u32 out = curve->lut[min_t(u32, abs(v), SKX_AXIS_MAX) >> SKX_CURVE_SHIFT];
+
+  return v < 0 ? -(s32)out : (s32)out;
+}
+
+static inline s32 skx_curve_scale(s32 v, u32 gain)
+{
+  return clamp_t(s64, ((s64)v * gain) >> 16, -SKX_AXIS_MAX - 1, SKX_AXIS_MAX);
+}
+
+/*
+  Copies a 0x20 report into out with the sticks reshaped, one table
+  lookup per axis (per stick when radial). Sticks set to raw are left as
+  they are.
+*/
+static inline void skx_shape_sticks(const struct skx_stick_curve *sticks, const u8 *data, u8 *out)
+{
+  const struct skx_stick_curve *curve;
+  unsigned int i, off;
+  s32 x, y;
+  u32 gain;
+
+  memcpy(out, data, REPORT_LEN);
+
+  for (i = 0; i < SKX_STICKS; i++) {
+    curve = &sticks[i];
+    if (curve->config.mode == SKX_STICK_RAW)
+      continue;
+
+    off = skx_stick_offsets[i];
+    x = (s16)le16_to_cpup((__le16 *)(data + off));
+    y = (s16)le16_to_cpup((__le16 *)(data + off + 2));
+
+    if (curve->config.mode == SKX_STICK_AXIAL) {
+      x = skx_curve_axis(curve, x);
+      y = skx_curve_axis(curve, y);
+    } else {
+      gain = curve->lut[min_t(u32, ((u32)(x * x) + (u32)(y * y)) >> SKX_CURVE_RADIAL_SHIFT,
+          SKX_CURVE_ENTRIES - 1)];
+      x = skx_curve_scale(x, gain);
+      y = skx_curve_scale(y, gain);
+    }
+
+    out[off] = x & 0xFF;
+    out[off + 1] = (x >> 8) & 0xFF;
+    out[off + 2] = y & 0xFF;
+    out[off + 3] = (y >> 8) & 0xFF;
+  }
+}
+
+/* Motors in the order of their bytes in the rumble packet */
+enum skx_motor {
+  SKX_MOTOR_LEFT_TRIGGER,
+  SKX_MOTOR_RIGHT_TRIGGER,
+  SKX_MOTOR_HEAVY,
+  SKX_MOTOR_LIGHT,
+  SKX_MOTORS
+};
+
+/*
+  One uploaded effect. weights is the share of the effect's level each
+  motor gets, worked out at upload time (condition effects: from every
+  report while they play) so playing an effect is just setting its bit in
+  active.
+*/
+struct skx_ff_voice {
+  struct ff_effect effect;
+  ktime_t start;           /* start of the current repetition, before its delay */
+  unsigned int count;      /* repetitions left, including the current one */
+  u16 weights[SKX_MOTORS];
+};
+
+/*
+  What one rumble packet asks of the pad: the motors run for on, stop for
+  off, and that is repeated repeat more times. on and off are in 10ms.
+*/
+struct skx_rumble {
+  u8 motors[SKX_MOTORS];
+  u8 on;
+  u8 off;
+  u8 repeat;
+};
+
+/*
+  Where the analog controls are, for condition effects. Positions are
+  0..0x7FFF for the triggers and signed 16 bit for the sticks. Stick
+  velocity is measured between the completions of two reports, averaged
+  with the previous reading and scaled so that travel from centre to
+  edge (0x8000) in SKX_FF_VELOCITY_MS is 0x7FFF, the most it can be.
+*/
+struct skx_ff_pad {
+  s32 triggers[2];
+  s32 sticks[SKX_STICKS][2];
+  s32 velocity[SKX_STICKS][2];
+  ktime_t stamp;  /* completion of the last report, 0 before the first */
+};
+
+struct skx_ff_engine {
+  struct skx_ff_voice voices[FF_EFFECTS];
+  struct skx_ff_pad pad;
+  DECLARE_BITMAP(active, FF_EFFECTS);
+  u16 gain;
+  struct skx_rumble sent;  /* last packet sent */
+  ktime_t sent_at;
+  ktime_t offload_end;     /* when the pad is done with a pattern it was given, or 0 */
+  ktime_t period;          /* OUT endpoint interval, nothing changes faster */
+};
+
+/*
+  Which motors an FF_RUMBLE drives, by the quarter its direction points
+  to (0x0000 down, 0x4000 left, 0x8000 up, 0xC000 right). Down is the
+  body, as every rumble without a direction; up is both triggers, strong
+  on the left and weak on the right; left and right are one trigger each,
+  at the stronger of the two magnitudes.
+*/
+enum skx_rumble_channel {
+  SKX_RUMBLE_BODY,
+  SKX_RUMBLE_LEFT_TRIGGER,
+  SKX_RUMBLE_TRIGGERS,
+  SKX_RUMBLE_RIGHT_TRIGGER
+};
+
+static inline enum skx_rumble_channel skx_rumble_channel(u16 direction)
+{
+  return (u16)(direction + 0x2000) >> 14;
+}
+
+/*
+  Works out the motor weights of a freshly uploaded effect. Condition
+  effects depend on the pad, skx_ff_condition() weights them.
+*/
+static inline void skx_ff_compile(struct skx_ff_voice *v)
+{
+  struct ff_effect *effect = &v->effect;
+  u16 strong, weak;
+
+  memset(v->weights, 0, sizeof(v->weights));
+
+  switch (effect->type) {
+    case FF_RUMBLE:
+      strong = effect->u.rumble.strong_magnitude >> 1;
+      weak = effect->u.rumble.weak_magnitude >> 1;
+
+      switch (skx_rumble_channel(effect->direction)) {
+        case SKX_RUMBLE_BODY:
+          v->weights[SKX_MOTOR_HEAVY] = strong;
+          v->weights[SKX_MOTOR_LIGHT] = weak;
+          break;
+        case SKX_RUMBLE_LEFT_TRIGGER:
+          v->weights[SKX_MOTOR_LEFT_TRIGGER] = max(strong, weak);
+          break;
+        case SKX_RUMBLE_TRIGGERS:
+          v->weights[SKX_MOTOR_LEFT_TRIGGER] = strong;
+          v->weights[SKX_MOTOR_RIGHT_TRIGGER] = weak;
+          break;
+        case SKX_RUMBLE_RIGHT_TRIGGER:
+          v->weights[SKX_MOTOR_RIGHT_TRIGGER] = max(strong, weak);
+          break;
+      }
+      break;
+    case FF_CONSTANT:
+    case FF_PERIODIC:
+      v->weights[SKX_MOTOR_HEAVY] = 0x7FFF;
+      v->weights[SKX_MOTOR_LIGHT] = 0x7FFF;
+      break;
+  }
+}
+
+static inline bool skx_ff_is_condition(const struct skx_ff_voice *v)
+{
+  return v->effect.type == FF_SPRING || v->effect.type == FF_DAMPER;
+}
+
+/*
+  The force (0..0x7FFF) one axis of a condition effect asks for at value:
+  nothing within deadband around center, then coefficient times the
+  distance from its edge, up to the saturation of that side. Motors can
+  only push one way, so left and right only differ in their coefficient
+  and saturation, and a zero saturation means no limit.
+*/
+static inline u32 skx_ff_condition_force(const struct ff_condition_effect *c, s32 value)
+{
+  s32 d = value - c->center;
+  u32 force, saturation;
+  s16 coeff;
+
+  if (d >= 0) {
+    coeff = c->right_coeff;
+    saturation = c->right_saturation;
+  } else {
+    d = -d;
+    coeff = c->left_coeff;
+    saturation = c->left_saturation;
+  }
+
+  d -= c->deadband / 2;
+  if (d <= 0)
+    return 0;
+
+  force = (u32)abs(coeff) * d / 0x7FFF;
+  if (saturation)
+    force = min(force, saturation >> 1);
+
+  return min_t(u32, force, 0x7FFF);
+}
+
+/*
+  Weights a condition effect against the pad. A spring holds each trigger
+  against its pull, condition[0] the left one and condition[1] the right
+  one, on that trigger's motor. A damper resists stick motion, condition[0]
+  along x and condition[1] along y, with the left stick on the heavy motor
+  and the right stick on the light one, the grips they sit over.
+*/
+static inline void skx_ff_condition(const struct skx_ff_pad *pad, const struct skx_ff_voice *v,
+    u16 *weights)
+{
+  const struct ff_condition_effect *c = v->effect.u.condition;
+  int s;
+
+  memset(weights, 0, sizeof(u16) * SKX_MOTORS);
+
+  switch (v->effect.type) {
+    case FF_SPRING:
+      weights[SKX_MOTOR_LEFT_TRIGGER] = skx_ff_condition_force(&c[0], pad->triggers[0]);
+      weights[SKX_MOTOR_RIGHT_TRIGGER] = skx_ff_condition_force(&c[1], pad->triggers[1]);
+      break;
+    case FF_DAMPER:
+      for (s = 0; s < SKX_STICKS; s++)
+        weights[SKX_MOTOR_HEAVY + s] = max(skx_ff_condition_force(&c[0], pad->velocity[s][0]),
+            skx_ff_condition_force(&c[1], pad->velocity[s][1]));
+      break;
+  }
+}
+
+/*
+  Takes the analog controls of an input report completed at ts and moves
+  every playing condition effect whose weights changed by at least
+  SKX_FF_CONDITION_STEP, about one step of a motor, so reports that cannot
+  change what the motors do don't cost a packet. Velocity is averaged
+  over two reports to take the edge off the sticks' quantisation, and
+  restarts from zero after a gap of more than SKX_FF_VELOCITY_GAP_MS.
+  Returns when the engine has to be stepped for them, which is held off
+  until one OUT interval after the last packet so a moving stick can't
+  queue rumble faster than the pad takes it, or KTIME_MAX if nothing
+  moved.
+*/
+static inline ktime_t skx_ff_track(struct skx_ff_engine *ff, const u8 *data, ktime_t ts)
+{
+  struct skx_ff_pad *pad = &ff->pad;
+  struct skx_ff_voice *v;
+  u16 weights[SKX_MOTORS];
+  s64 dt = ktime_sub(ts, pad->stamp);
+  u32 scale = 0;
+  s32 value, speed;
+  bool moved, changed = false;
+  int id, s, a;
+
+  if (pad->stamp && dt > 0 && dt <= SKX_FF_VELOCITY_GAP_MS * NSEC_PER_MSEC)
+    scale = div_u64((u64)SKX_FF_VELOCITY_MS * NSEC_PER_MSEC << 16, dt);
+  pad->stamp = ts;
+
+  pad->triggers[0] = le16_to_cpup((__le16 *)(data + 6)) * 0x7FFF / 1023;
+  pad->triggers[1] = le16_to_cpup((__le16 *)(data + 8)) * 0x7FFF / 1023;
+
+  for (s = 0; s < SKX_STICKS; s++) {
+    for (a = 0; a < 2; a++) {
+      value = (s16)le16_to_cpup((__le16 *)(data + skx_stick_offsets[s] + a * 2));
+      speed = clamp_t(s64, ((s64)(value - pad->sticks[s][a]) * scale) >> 16, -0x7FFF, 0x7FFF);
+      pad->velocity[s][a] = scale ? (pad->velocity[s][a] + speed) / 2 : 0;
+      pad->sticks[s][a] = value;
+    }
+  }
+
+  for_each_set_bit(id, ff->active, FF_EFFECTS) {
+    v = &ff->voices[id];
+    if (!skx_ff_is_condition(v))
+      continue;
+
+    skx_ff_condition(pad, v, weights);
+
+    moved = false;
+    for (a = 0; a < SKX_MOTORS; a++)
+      if (abs(weights[a] - v->weights[a]) >= SKX_FF_CONDITION_STEP ||
+          !weights[a] != !v->weights[a])
+        moved = true;
+
+    if (moved) {
+      memcpy(v->weights, weights, sizeof(weights));
+      changed = true;
+    }
+  }
+
+  if (!changed)
+    return KTIME_MAX;
+
+  return max(ts, ktime_add(ff->sent_at, ff->period));
+}
+
+/*
+  Scales a magnitude by the attack or fade envelope, t is the time in ms
+  since the current repetition started.
+*/
+static inline u32 skx_ff_envelope(const struct ff_envelope *env, u16 length, u32 level, u32 t)
+{
+  s32 target, span, elapsed;
+
+  if (env->attack_length && t < env->attack_length) {
+    target = min_t(u16, env->attack_level, 0x7FFF);
+    span = env->attack_length;
+    elapsed = t;
+  } else if (length && env->fade_length && t + env->fade_length > length) {
+    target = min_t(u16, env->fade_level, 0x7FFF);
+    span = env->fade_length;
+    elapsed = length - t;
+  } else {
+    return level;
+  }
+
+  return target + ((s32)level - target) * elapsed / span;
+}
+
+/* Motors can only push one way, so waveforms are rendered 0..0x7FFF */
+static inline u32 skx_ff_waveform(const struct ff_periodic_effect *periodic, u32 t)
+{
+  u32 pos;
+
+  if (!periodic->period)
+    return 0x7FFF;
+
+  /* Phase is a fraction of the period, 0x10000 being a full cycle */
+  pos = ((t % periodic->period) * 0x10000 / periodic->period + periodic->phase) & 0xFFFF;
+
+  switch (periodic->waveform) {
+    case FF_SQUARE:
+      return pos < 0x8000 ? 0x7FFF : 0;
+    case FF_TRIANGLE:
+      return pos < 0x8000 ? pos : 0xFFFF - pos;
+    case FF_SINE:
+      return (0x7FFF + fixp_sin16(pos * 360 >> 16)) / 2;
+    case FF_SAW_UP:
+      return pos >> 1;
+    case FF_SAW_DOWN:
+      return 0x7FFF - (pos >> 1);
+  }
+
+  return 0;
+}
+
+/* Whether an envelope is ramping at t, or else when it will start to */
+static inline ktime_t skx_ff_envelope_next(struct skx_ff_engine *ff, const struct ff_envelope *env,
+    u16 length, u32 t, ktime_t now, ktime_t end)
+{
+  if (env->attack_length && t < env->attack_length)
+    return ktime_add(now, ff->period);
+
+  if (length && env->fade_length) {
+    if (t + env->fade_length >= length)
+      return ktime_add(now, ff->period);
+    return ktime_add_ms(now, length - env->fade_length - t);
+  }
+
+  return end;
+}
+
+/*
+  Works out the level (0..0x7FFF) of the voice at now, before it is spread
+  over the motors. Returns when the level may change next, KTIME_MAX if
+  it won't. A voice that has played out is left with a zero count.
+*/
+static inline ktime_t skx_ff_render(struct skx_ff_engine *ff, struct skx_ff_voice *v,
+    ktime_t now, u32 *level)
+{
+  struct ff_effect *effect = &v->effect;
+  const struct ff_envelope *env;
+  ktime_t begin, end = KTIME_MAX;
+  u32 t;
+  s32 value;
+
+  *level = 0;
+
+  begin = ktime_add_ms(v->start, effect->replay.delay);
+  if (ktime_before(now, begin))
+    return begin;
+
+  if (effect->replay.length) {
+    end = ktime_add_ms(begin, effect->replay.length);
+
+    /* Move on to the next repetition, or stop after the last one */
+    while (!ktime_before(now, end)) {
+      if (--v->count == 0)
+        return KTIME_MAX;
+
+      v->start = end;
+      begin = ktime_add_ms(v->start, effect->replay.delay);
+      if (ktime_before(now, begin))
+        return begin;
+      end = ktime_add_ms(begin, effect->replay.length);
+    }
+  }
+
+  t = ktime_ms_delta(now, begin);
+
+  switch (effect->type) {
+    case FF_CONSTANT:
+      env = &effect->u.constant.envelope;
+      *level = skx_ff_envelope(env, effect->replay.length, abs(effect->u.constant.level), t);
+      return skx_ff_envelope_next(ff, env, effect->replay.length, t, now, end);
+
+    case FF_PERIODIC:
+      env = &effect->u.periodic.envelope;
+      *level = skx_ff_envelope(env, effect->replay.length, abs(effect->u.periodic.magnitude), t);
+      value = effect->u.periodic.offset + (s32)(*level * skx_ff_waveform(&effect->u.periodic, t) / 0x7FFF);
+      *level = clamp(value, 0, 0x7FFF);
+      return min(end, ktime_add(now, ff->period));
+
+    default:
+      /* Rumble and condition effects are all in their weights */
+      *level = 0x7FFF;
+      return end;
+  }
+}
+
+/*
+  Mixes every playing voice onto the motors. Returns when the mix may
+  change next.
+*/
+static inline ktime_t skx_ff_mix(struct skx_ff_engine *ff, ktime_t now, u16 *levels)
+{
+  struct skx_ff_voice *v;
+  u32 sum[SKX_MOTORS] = { 0 };
+  ktime_t next = KTIME_MAX;
+  u32 level;
+  int id, i;
+
+  for_each_set_bit(id, ff->active, FF_EFFECTS) {
+    v = &ff->voices[id];
+
+    next = min(next, skx_ff_render(ff, v, now, &level));
+    if (!v->count) {
+      __clear_bit(id, ff->active);
+      continue;
+    }
+
+    for (i = 0; i < SKX_MOTORS; i++)
+      sum[i] += level * v->weights[i] / 0x7FFF;
+  }
+
+  for (i = 0; i < SKX_MOTORS; i++)
+    levels[i] = min_t(u32, sum[i], 0x7FFF);
+
+  return next;
+}
+
+static inline u8 skx_ff_motor(struct skx_ff_engine *ff, u16 level)
+{
+  return div_u64((u64)min_t(u16, level, 0x7FFF) * ff->gain * MOTOR_MAX, 0x7FFF * 0xFFFF);
+}
+
+/*
+  A voice that is nothing but on/off pulses of one strength can be left to
+  the pad: one packet with the on time, off time and repeat count instead
+  of one per edge. That is a repeated FF_RUMBLE with a delay between the
+  repetitions, or an FF_SQUARE without envelope, offset or phase, with
+  times in whole 10ms. Only checked when the voice plays alone and at the
+  start of its first pulse (within one OUT interval, which the pattern
+  then runs late by). Fills r and *end, when the pad will be done.
+*/
+static inline bool skx_ff_pattern(struct skx_ff_engine *ff, struct skx_ff_voice *v,
+    ktime_t now, struct skx_rumble *r, ktime_t *end)
+{
+  struct ff_effect *effect = &v->effect;
+  const struct ff_periodic_effect *periodic = &effect->u.periodic;
+  unsigned int on, off, pulses, span;
+  ktime_t begin;
+  u32 level;
+  int i;
+
+  begin = ktime_add_ms(v->start, effect->replay.delay);
+  if (ktime_before(now, begin) || !ktime_before(now, ktime_add(begin, ff->period)))
+    return false;
+
+  switch (effect->type) {
+    case FF_RUMBLE:
+      on = effect->replay.length;
+      off = effect->replay.delay;
+      pulses = v->count;
+      span = pulses * on + (pulses - 1) * off;
+      level = 0x7FFF;
+      break;
+
+    case FF_PERIODIC:
+      if (periodic->waveform != FF_SQUARE || periodic->offset || periodic->phase ||
+          periodic->envelope.attack_length || periodic->envelope.fade_length ||
+          v->count != 1 || !periodic->period || periodic->period % 2 ||
+          effect->replay.length % periodic->period)
+        return false;
+      on = off = periodic->period / 2;
+      pulses = effect->replay.length / periodic->period;
+      span = effect->replay.length;
+      level = min_t(u32, abs(periodic->magnitude), 0x7FFF);
+      break;
+
+    default:
+      return false;
+  }
+
+  if (pulses < 2 || pulses > 256 || !on || !off ||
+      on % 10 || off % 10 || on > 2550 || off > 2550)
+    return false;
+
+  for (i = 0; i < SKX_MOTORS; i++)
+    r->motors[i] = skx_ff_motor(ff, level * v->weights[i] / 0x7FFF);
+  if (!memchr_inv(r->motors, 0, SKX_MOTORS))
+    return false;
+
+  r->on = on / 10;
+  r->off = off / 10;
+  r->repeat = pulses - 1;
+  *end = ktime_add_ms(begin, span);
+
+  return true;
+}
+
+/*
+  Forgets what the pad was last sent, after something other than the
+  engine drove its motors, so the next step sends whatever the engine
+  works out even if that is what it sent before.
+*/
+static inline void skx_ff_invalidate(struct skx_ff_engine *ff)
+{
+  memset(&ff->sent, 0xFF, sizeof(ff->sent));
+  ff->offload_end = 0;
+}
+
+/*
+  Renders the engine at now into a rumble packet. Returns true if it has
+  to go out: it changed, or a running motor has to be refreshed before
+  the pad's own effect length (2.55s) runs out. *next is when to render
+  again, KTIME_MAX if nothing is playing.
+*/
+static inline bool skx_ff_step(struct skx_ff_engine *ff, ktime_t now, struct skx_rumble *r,
+    ktime_t *next)
+{
+  u16 levels[SKX_MOTORS];
+  ktime_t end;
+  bool running, send = false;
+  int id, i;
+
+  /*
+    Stepping during a pattern means something changed and it will be
+    overridden; once it has played out the pad's motors are off.
+  */
+  if (ff->offload_end) {
+    if (!ktime_before(now, ff->offload_end))
+      memset(&ff->sent, 0, sizeof(ff->sent));
+    ff->offload_end = 0;
+  }
+
+  *next = skx_ff_mix(ff, now, levels);
+
+  memset(r, 0, sizeof(*r));
+
+  id = find_first_bit(ff->active, FF_EFFECTS);
+  if (id < FF_EFFECTS && find_next_bit(ff->active, FF_EFFECTS, id + 1) >= FF_EFFECTS &&
+      skx_ff_pattern(ff, &ff->voices[id], now, r, &end)) {
+    /* Nothing to do until the pad has played it */
+    ff->offload_end = end;
+    *next = end;
+    running = false;
+  } else {
+    for (i = 0; i < SKX_MOTORS; i++)
+      r->motors[i] = skx_ff_motor(ff, levels[i]);
+
+    running = memchr_inv(r->motors, 0, SKX_MOTORS) != NULL;
+    if (running)
+      r->on = 0xFF;
+  }
+
+  if (memcmp(r, &ff->sent, sizeof(*r)) ||
+      (running && ktime_ms_delta(now, ff->sent_at) >= FF_REFRESH_MS)) {
+    ff->sent = *r;
+    ff->sent_at = now;
+    send = true;
+  }
+
+  if (running)
+    *next = min(*next, ktime_add_ms(ff->sent_at, FF_REFRESH_MS));
+
+  /* Nothing can go out faster than the OUT endpoint is polled */
+  if (*next != KTIME_MAX)
+    *next = max(*next, ktime_add(now, ff->period));
+
+  return send;
+}
+
+struct output_packet {
+  u8 data[PKT_LEN];
+  u8 len;
+  ktime_t stamp;  /* when the FF event behind it happened, 0 for other packets */
+};
+
+/*
+  Output packets are queued per class and the classes are drained in
+  order, so an ack never waits behind rumble. Haptics only ever hold one
+  packet: a newer rumble update replaces the one still waiting.
+*/
+enum skx_out_class {
+  SKX_OUT_ACK,
+  SKX_OUT_INIT,
+  SKX_OUT_FF,
+  SKX_OUT_CLASSES
+};
+
+struct output_queue {
+  struct output_packet packets[OUT_QUEUE_LEN];
+  u8 head;
+  u8 count;
+};
+
+/*
+  Returns the packet to fill for the given class, or NULL if that class is
+  full. For haptics this is the still unsent packet if there is one, in
+  which case *pending is set.
+*/
+static inline struct output_packet *skx_out_queue(struct output_queue *queues,
+    enum skx_out_class cls, bool *pending)
+{
+  struct output_queue *q = &queues[cls];
+  struct output_packet *packet;
+
+  *pending = cls == SKX_OUT_FF && q->count;
+  if (*pending)
+    return &q->packets[(q->head + q->count - 1) % OUT_QUEUE_LEN];
+
+  if (q->count == OUT_QUEUE_LEN)
+    return NULL;
+
+  packet = &q->packets[(q->head + q->count++) % OUT_QUEUE_LEN];
+  packet->stamp = 0;
+
+  return packet;
+}
+
+static inline unsigned int skx_out_depth(const struct output_queue *queues)
+{
+  unsigned int depth = 0;
+  int cls;
+
+  for (cls = 0; cls < SKX_OUT_CLASSES; cls++)
+    depth += queues[cls].count;
+
+  return depth;
+}
+
+/*
+  Takes the next packet off the queues, classes in order, copies it to buf
+  and stamps our sequence number on it. Returns NULL if nothing is queued.
+  The packet stays valid until its class is queued to again.
+*/
+static inline const struct output_packet *skx_out_take(struct output_queue *queues,
+    u8 *buf, u8 *serial)
+{
+  struct output_queue *q;
+  struct output_packet *packet;
+  int cls;
+
+  for (cls = 0; cls < SKX_OUT_CLASSES; cls++) {
+    q = &queues[cls];
+    if (!q->count)
+      continue;
+
+    packet = &q->packets[q->head];
+    q->head = (q->head + 1) % OUT_QUEUE_LEN;
+    q->count--;
+
+    memcpy(buf, packet->data, packet->len);
+
+    /* Acks echo the pad's sequence number, everything else uses ours */
+    if (cls != SKX_OUT_ACK)
+      buf[2] = (*serial)++;
+
+    return packet;
+  }
+
+  return NULL;
+}
+
+/* Builds the 0x09 rumble packet, the sequence byte is filled in when sent */
+static inline u8 skx_build_rumble(u8 *data, const struct skx_rumble *r)
+{
+  data[0] = 0x09;
+  data[1] = 0x00;
+  data[2] = 0x00; // Sequence, filled in when sent
+  data[3] = 0x09;
+  data[4] = 0x00;
+  data[5] = 0x0F;
+  data[6] = r->motors[SKX_MOTOR_LEFT_TRIGGER]; // Left Trigger Strength MIN 00 MAX 0x64
+  data[7] = r->motors[SKX_MOTOR_RIGHT_TRIGGER]; // Right Trigger Strength MIN 00 MAX 0x64
+  data[8] = r->motors[SKX_MOTOR_HEAVY]; // Heavy Rumble Strength MIN 40 MAX 0x64, off 00
+  data[9] = r->motors[SKX_MOTOR_LIGHT]; // Light Rumble Strength MIN 40 MAX 0x64, off 00
+  data[10] = r->on; // Effect Length MIN 0x00 MAX FF
+  data[11] = r->off; // Break Length MIN 0x00 MAX FF
+  data[12] = r->repeat; // Number of additional effects  MIN 0x00 MAX FF
+
+  return RUMBLE_LEN;
+}
+
+/*
+  Bring-up of the pad, driven from the URB completions once probe (or
+  resume) has submitted the input ring and queued the first packet. Each
+  packet only goes out once the previous one has completed:
+
+    SKX_HS_ACK       fixed ack of the pad's identify reply queued
+    SKX_HS_POWER_ON  ack sent, power on queued
+    SKX_HS_WAIT      power on sent, waiting for the first input report
+    SKX_HS_READY     the pad is reporting
+
+  The driver's hs_work sends power on again if no report follows it in
+  time.
+*/
+enum skx_handshake {
+  SKX_HS_ACK,
+  SKX_HS_POWER_ON,
+  SKX_HS_WAIT,
+  SKX_HS_READY
+};
+
+/* A haptic stream as the OUT side plays it: ring is userspace's, the rest ours */
+struct skx_haptic_stream {
+  struct skx_haptic_ring *ring;
+  u32 tail;
+  bool playing;
+};
+
+/*
+  The OUT endpoint: one URB, so at most one packet in flight, sent from
+  buf. skx_out_send() starts it when it is idle and skx_out_complete()
+  picks what follows a packet that went out; both return SKX_OUT_* bits
+  for what the caller is left to do, which is submitting buf and anything
+  that needs more than the lock it holds the state under.
+*/
+enum {
+  SKX_OUT_SUBMIT = 1 << 0,      /* submit buf, len bytes */
+  SKX_OUT_HS_WAIT = 1 << 1,     /* power on went out, wait for the first report */
+  SKX_OUT_HAPTIC = 1 << 2,      /* a haptic frame was taken, the ring has room */
+  SKX_OUT_HAPTIC_DRY = 1 << 3,  /* the haptic stream ran dry and went idle */
+};
+
+struct skx_out {
+  struct output_queue queues[SKX_OUT_CLASSES];
+  struct skx_haptic_stream *haptic;  /* NULL without a stream */
+  enum skx_handshake hs_state;
+  u8 serial;
+  bool active;  /* a packet is in flight */
+  bool paused;  /* nothing may be submitted */
+
+  /* The packet in buf */
+  u8 len;
+  ktime_t stamp;
+};
+
+/* Returns the INIT packet to fill, or NULL if that class is full */
+static inline struct output_packet *skx_out_queue_init(struct skx_out *out, const u8 *data, u8 len)
+{
+  struct output_packet *packet;
+  bool pending;
+
+  packet = skx_out_queue(out->queues, SKX_OUT_INIT, &pending);
+  if (packet) {
+    memcpy(packet->data, data, len);
+    packet->len = len;
+  }
+
+  return packet;
+}
+
+static inline struct output_packet *skx_out_power_on(struct skx_out *out)
+{
+  static const u8 power_on[] = {0x05, 0x20, 0x00, 0x01, 0x00};
+
+  out->hs_state = SKX_HS_POWER_ON;
+  return skx_out_queue_init(out, power_on, sizeof(power_on));
+}
+
+/* The handshake packet in buf has gone out, queue the next step */
+static inline unsigned int skx_out_hs_sent(struct skx_out *out, const u8 *buf)
+{
+  switch (out->hs_state) {
+    case SKX_HS_ACK:
+      if (buf[0] == 0x01)
+        skx_out_power_on(out);
+      break;
+    case SKX_HS_POWER_ON:
+      if (buf[0] == 0x05) {
+        out->hs_state = SKX_HS_WAIT;
+        return SKX_OUT_HS_WAIT;
+      }
+      break;
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+/*
+  Takes the next frame of the haptic stream into buf as a rumble packet.
+  A frame runs the motors until the next one; when the ring runs dry the
+  stream idles and the FF engine is to take the motors back. head and the
+  frames come from userspace and are trusted no further than the ring's
+  size and the motors' range.
+*/
+static inline unsigned int skx_out_haptic(struct skx_out *out, u8 *buf)
+{
+  struct skx_haptic_stream *hs = out->haptic;
+  const struct skx_haptic_frame *frame;
+  struct skx_rumble r = { };
+  u32 head;
+  int i;
+
+  if (!hs)
+    return 0;
+
+  head = smp_load_acquire(&hs->ring->head);
+  if (head - hs->tail - 1 >= SKX_HAPTIC_FRAMES) {
+    if (!hs->playing)
+      return 0;
+    hs->playing = false;
+    return SKX_OUT_HAPTIC_DRY;
+  }
+
+  frame = &hs->ring->frame[hs->tail % SKX_HAPTIC_FRAMES];
+  for (i = 0; i < SKX_MOTORS; i++)
+    r.motors[i] = min_t(u8, READ_ONCE(frame->motors[i]), MOTOR_MAX);
+  r.on = 0xFF;
+
+  hs->tail++;
+  smp_store_release(&hs->ring->tail, hs->tail);
+  hs->playing = true;
+
+  out->len = skx_build_rumble(buf, &r);
+  buf[2] = out->serial++;
+  out->stamp = 0;
+
+  return SKX_OUT_SUBMIT | SKX_OUT_HAPTIC;
+}
+
+/* Takes the next packet into buf: the queues in class order, then the haptic stream */
+static inline unsigned int skx_out_next(struct skx_out *out, u8 *buf)
+{
+  const struct output_packet *packet;
+
+  packet = skx_out_take(out->queues, buf, &out->serial);
+  if (!packet)
+    return skx_out_haptic(out, buf);
+
+  out->len = packet->len;
+  out->stamp = packet->stamp;
+
+  return SKX_OUT_SUBMIT;
+}
+
+/* Something was queued or the haptic stream kicked, send it unless busy */
+static inline unsigned int skx_out_send(struct skx_out *out, u8 *buf)
+{
+  unsigned int todo;
+
+  if (out->active || out->paused)
+    return 0;
+
+  todo = skx_out_next(out, buf);
+  out->active = todo & SKX_OUT_SUBMIT;
+
+  return todo;
+}
+
+/*
+  The packet in buf has gone out: steps the handshake on it, then takes
+  whatever follows unless paused. A submit that fails after either call
+  must clear active again.
+*/
+static inline unsigned int skx_out_complete(struct skx_out *out, u8 *buf)
+{
+  unsigned int todo = 0;
+
+  if (out->hs_state != SKX_HS_READY)
+    todo = skx_out_hs_sent(out, buf);
+
+  out->active = false;
+  if (!out->paused)
+    todo |= skx_out_next(out, buf);
+  out->active = todo & SKX_OUT_SUBMIT;
+
+  return todo;
+}
+
+#endif
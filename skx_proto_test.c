@@ -0,0 +1,612 @@
+/*
+  KUnit suite for the OUT state machine in skx_proto.h, the very
+  skx_out_send() and skx_out_complete() that skx_send_packet() and
+  skx_interrupt_out() drive. A mock bus stands in for the OUT URB: it
+  takes whatever a call asks to have submitted and completes it when the
+  test says so, or from a kthread racing FF, ack and haptic producers in
+  the stress case. See the Tests section of README.md for running it
+  under UML.
+*/
+
+#include <kunit/test.h>
+#include <linux/atomic.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/sched/task.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+
+#include "skx_proto.h"
+
+#define SKX_TEST_REQUESTS 20000      /* ids are 16 bits on the wire */
+#define SKX_TEST_PAUSE_EVERY 64      /* completions between two pauses */
+#define SKX_TEST_STRESS_MS 30000     /* the stress case must finish in this long */
+
+/* Mock of the OUT URB, the state as skx.c keeps it under output_data_lock */
+struct skx_test_bus {
+  struct skx_out out;
+  struct skx_haptic_stream haptic;
+  u8 buf[PKT_LEN];  /* output_data */
+  int submit_err;   /* what usb_submit_urb() fails with, 0 to succeed */
+
+  /* What the state machine left to the driver */
+  unsigned int submits;
+  unsigned int hs_waits;
+  unsigned int haptic_taken;
+  unsigned int haptic_dry;
+};
+
+/* As skx_out_submit() */
+static int skx_test_submit(struct skx_test_bus *bus, unsigned int todo)
+{
+  if (todo & SKX_OUT_HS_WAIT)
+    bus->hs_waits++;
+  if (todo & SKX_OUT_HAPTIC)
+    bus->haptic_taken++;
+  if (todo & SKX_OUT_HAPTIC_DRY)
+    bus->haptic_dry++;
+
+  if (!(todo & SKX_OUT_SUBMIT))
+    return 0;
+
+  if (bus->submit_err) {
+    bus->out.active = false;
+    return bus->submit_err;
+  }
+
+  bus->submits++;
+  return 0;
+}
+
+/* As skx_send_packet() */
+static int skx_test_send(struct skx_test_bus *bus)
+{
+  return skx_test_submit(bus, skx_out_send(&bus->out, bus->buf));
+}
+
+/* As skx_interrupt_out() with status 0 */
+static void skx_test_complete(struct skx_test_bus *bus)
+{
+  skx_test_submit(bus, skx_out_complete(&bus->out, bus->buf));
+}
+
+static struct skx_test_bus *skx_test_bus_alloc(struct kunit *test)
+{
+  struct skx_test_bus *bus;
+
+  bus = kunit_kzalloc(test, sizeof(*bus), GFP_KERNEL);
+  KUNIT_ASSERT_NOT_ERR_OR_NULL(test, bus);
+
+  bus->haptic.ring = kunit_kzalloc(test, sizeof(*bus->haptic.ring), GFP_KERNEL);
+  KUNIT_ASSERT_NOT_ERR_OR_NULL(test, bus->haptic.ring);
+  bus->haptic.ring->frames = SKX_HAPTIC_FRAMES;
+
+  bus->out.haptic = &bus->haptic;
+  bus->out.hs_state = SKX_HS_READY;
+
+  return bus;
+}
+
+/* Queues a packet of cls tagged in a byte that skx_out_take() never touches */
+static void skx_test_queue(struct kunit *test, struct skx_test_bus *bus,
+    enum skx_out_class cls, u8 cmd, u8 tag)
+{
+  struct output_packet *packet;
+  bool pending;
+
+  packet = skx_out_queue(bus->out.queues, cls, &pending);
+  KUNIT_ASSERT_NOT_ERR_OR_NULL(test, packet);
+
+  memset(packet->data, 0, ACK_LEN);
+  packet->data[0] = cmd;
+  packet->data[2] = tag;
+  packet->data[5] = tag;
+  packet->len = ACK_LEN;
+}
+
+static void skx_test_handshake(struct kunit *test)
+{
+  static const u8 identify_ack[] = {
+    0x01, 0x20, 0x00, 0x09, 0x00,
+    0x04, 0x20, 0x3a, 0x00, 0x00,
+    0x00, 0x80, 0x00
+  };
+  struct skx_test_bus *bus = skx_test_bus_alloc(test);
+
+  /* As skx_start_input() */
+  bus->out.hs_state = SKX_HS_ACK;
+  KUNIT_ASSERT_NOT_ERR_OR_NULL(test, skx_out_queue_init(&bus->out, identify_ack,
+        sizeof(identify_ack)));
+  KUNIT_EXPECT_EQ(test, skx_test_send(bus), 0);
+  KUNIT_EXPECT_TRUE(test, bus->out.active);
+  KUNIT_EXPECT_EQ(test, bus->buf[0], 0x01);
+  KUNIT_EXPECT_EQ(test, bus->buf[2], 0);
+
+  /* The ack going out queues power on, which follows it straight away */
+  skx_test_complete(bus);
+  KUNIT_EXPECT_EQ(test, bus->out.hs_state, SKX_HS_POWER_ON);
+  KUNIT_EXPECT_TRUE(test, bus->out.active);
+  KUNIT_EXPECT_EQ(test, bus->buf[0], 0x05);
+  KUNIT_EXPECT_EQ(test, bus->buf[2], 1);
+
+  /* Power on out, the driver is told to wait for the first report */
+  skx_test_complete(bus);
+  KUNIT_EXPECT_EQ(test, bus->out.hs_state, SKX_HS_WAIT);
+  KUNIT_EXPECT_EQ(test, bus->hs_waits, 1);
+  KUNIT_EXPECT_FALSE(test, bus->out.active);
+  KUNIT_EXPECT_EQ(test, bus->submits, 2);
+
+  /* Nothing steps the handshake past WAIT but a report */
+  skx_test_queue(test, bus, SKX_OUT_INIT, 0x05, 0);
+  skx_test_send(bus);
+  skx_test_complete(bus);
+  KUNIT_EXPECT_EQ(test, bus->out.hs_state, SKX_HS_WAIT);
+  KUNIT_EXPECT_EQ(test, bus->hs_waits, 1);
+}
+
+static void skx_test_class_order(struct kunit *test)
+{
+  struct skx_test_bus *bus = skx_test_bus_alloc(test);
+
+  skx_test_queue(test, bus, SKX_OUT_FF, 0x09, 1);
+  skx_test_send(bus);
+  KUNIT_EXPECT_EQ(test, bus->buf[5], 1);
+  KUNIT_EXPECT_EQ(test, bus->buf[2], 0);
+
+  /* Queued behind the packet in flight, in the reverse of class order */
+  skx_test_queue(test, bus, SKX_OUT_FF, 0x09, 2);
+  skx_test_queue(test, bus, SKX_OUT_INIT, 0x05, 3);
+  skx_test_queue(test, bus, SKX_OUT_ACK, 0x01, 0x77);
+  KUNIT_EXPECT_EQ(test, skx_test_send(bus), 0);
+  KUNIT_EXPECT_EQ(test, bus->submits, 1);
+
+  /* Acks keep the pad's sequence number, the rest get ours in turn */
+  skx_test_complete(bus);
+  KUNIT_EXPECT_EQ(test, bus->buf[0], 0x01);
+  KUNIT_EXPECT_EQ(test, bus->buf[2], 0x77);
+
+  skx_test_complete(bus);
+  KUNIT_EXPECT_EQ(test, bus->buf[5], 3);
+  KUNIT_EXPECT_EQ(test, bus->buf[2], 1);
+
+  skx_test_complete(bus);
+  KUNIT_EXPECT_EQ(test, bus->buf[5], 2);
+  KUNIT_EXPECT_EQ(test, bus->buf[2], 2);
+
+  skx_test_complete(bus);
+  KUNIT_EXPECT_FALSE(test, bus->out.active);
+  KUNIT_EXPECT_EQ(test, bus->submits, 4);
+  KUNIT_EXPECT_EQ(test, skx_out_depth(bus->out.queues), 0);
+}
+
+static void skx_test_ff_replace(struct kunit *test)
+{
+  struct skx_test_bus *bus = skx_test_bus_alloc(test);
+  struct output_packet *packet;
+  bool pending;
+
+  skx_test_queue(test, bus, SKX_OUT_FF, 0x09, 1);
+  skx_test_send(bus);
+
+  skx_test_queue(test, bus, SKX_OUT_FF, 0x09, 2);
+  packet = skx_out_queue(bus->out.queues, SKX_OUT_FF, &pending);
+  KUNIT_EXPECT_TRUE(test, pending);
+  packet->data[5] = 3;
+  KUNIT_EXPECT_EQ(test, skx_out_depth(bus->out.queues), 1);
+
+  /* Only the newest update goes out, and the serial doesn't skip */
+  skx_test_complete(bus);
+  KUNIT_EXPECT_EQ(test, bus->buf[5], 3);
+  KUNIT_EXPECT_EQ(test, bus->buf[2], 1);
+
+  skx_test_complete(bus);
+  KUNIT_EXPECT_FALSE(test, bus->out.active);
+}
+
+static void skx_test_ack_full(struct kunit *test)
+{
+  struct skx_test_bus *bus = skx_test_bus_alloc(test);
+  struct output_packet *packet;
+  bool pending;
+  int i;
+
+  skx_test_queue(test, bus, SKX_OUT_FF, 0x09, 0);
+  skx_test_send(bus);
+
+  for (i = 0; i < OUT_QUEUE_LEN; i++)
+    skx_test_queue(test, bus, SKX_OUT_ACK, 0x01, i);
+
+  packet = skx_out_queue(bus->out.queues, SKX_OUT_ACK, &pending);
+  KUNIT_EXPECT_PTR_EQ(test, packet, NULL);
+  KUNIT_EXPECT_FALSE(test, pending);
+
+  for (i = 0; i < OUT_QUEUE_LEN; i++) {
+    skx_test_complete(bus);
+    KUNIT_EXPECT_EQ(test, bus->buf[0], 0x01);
+    KUNIT_EXPECT_EQ(test, bus->buf[5], i);
+  }
+
+  skx_test_complete(bus);
+  KUNIT_EXPECT_FALSE(test, bus->out.active);
+}
+
+static void skx_test_paused(struct kunit *test)
+{
+  struct skx_test_bus *bus = skx_test_bus_alloc(test);
+
+  skx_test_queue(test, bus, SKX_OUT_FF, 0x09, 1);
+  skx_test_send(bus);
+
+  /* As skx_set_intervals(): the packet in flight completes, nothing follows */
+  bus->out.paused = true;
+  skx_test_queue(test, bus, SKX_OUT_ACK, 0x01, 2);
+  KUNIT_EXPECT_EQ(test, skx_test_send(bus), 0);
+  skx_test_complete(bus);
+  KUNIT_EXPECT_FALSE(test, bus->out.active);
+  KUNIT_EXPECT_EQ(test, bus->submits, 1);
+  KUNIT_EXPECT_EQ(test, skx_out_depth(bus->out.queues), 1);
+
+  skx_test_send(bus);
+  KUNIT_EXPECT_EQ(test, bus->submits, 1);
+
+  /* And picks up where it left off once restarted */
+  bus->out.paused = false;
+  bus->out.active = false;
+  skx_test_send(bus);
+  KUNIT_EXPECT_TRUE(test, bus->out.active);
+  KUNIT_EXPECT_EQ(test, bus->buf[5], 2);
+  KUNIT_EXPECT_EQ(test, bus->submits, 2);
+}
+
+static void skx_test_submit_failed(struct kunit *test)
+{
+  struct skx_test_bus *bus = skx_test_bus_alloc(test);
+
+  /* The packet is gone, but the endpoint must not be left marked busy */
+  bus->submit_err = -EIO;
+  skx_test_queue(test, bus, SKX_OUT_FF, 0x09, 1);
+  KUNIT_EXPECT_EQ(test, skx_test_send(bus), -EIO);
+  KUNIT_EXPECT_FALSE(test, bus->out.active);
+  KUNIT_EXPECT_EQ(test, skx_out_depth(bus->out.queues), 0);
+
+  bus->submit_err = 0;
+  skx_test_queue(test, bus, SKX_OUT_FF, 0x09, 2);
+  KUNIT_EXPECT_EQ(test, skx_test_send(bus), 0);
+  KUNIT_EXPECT_TRUE(test, bus->out.active);
+  KUNIT_EXPECT_EQ(test, bus->buf[5], 2);
+  KUNIT_EXPECT_EQ(test, bus->buf[2], 1);
+}
+
+static void skx_test_haptic(struct kunit *test)
+{
+  struct skx_test_bus *bus = skx_test_bus_alloc(test);
+  struct skx_haptic_ring *ring = bus->haptic.ring;
+  int i;
+
+  for (i = 0; i < 3; i++)
+    memset(ring->frame[i].motors, 0x10 * (i + 1), SKX_MOTORS);
+  ring->frame[1].motors[SKX_MOTOR_HEAVY] = 0xFF;
+  smp_store_release(&ring->head, 3);
+
+  skx_test_send(bus);
+  KUNIT_EXPECT_TRUE(test, bus->out.active);
+  KUNIT_EXPECT_EQ(test, bus->buf[0], 0x09);
+  KUNIT_EXPECT_EQ(test, bus->buf[6], 0x10);
+  KUNIT_EXPECT_EQ(test, bus->buf[2], 0);
+  KUNIT_EXPECT_EQ(test, ring->tail, 1);
+  KUNIT_EXPECT_TRUE(test, bus->haptic.playing);
+  KUNIT_EXPECT_EQ(test, bus->haptic_taken, 1);
+
+  /* Anything queued goes before the next frame */
+  skx_test_queue(test, bus, SKX_OUT_ACK, 0x01, 0x40);
+  skx_test_complete(bus);
+  KUNIT_EXPECT_EQ(test, bus->buf[0], 0x01);
+  KUNIT_EXPECT_EQ(test, ring->tail, 1);
+
+  /* Userspace's levels are clamped to what the motors take */
+  skx_test_complete(bus);
+  KUNIT_EXPECT_EQ(test, bus->buf[6], 0x20);
+  KUNIT_EXPECT_EQ(test, bus->buf[8], MOTOR_MAX);
+  KUNIT_EXPECT_EQ(test, bus->buf[2], 1);
+
+  skx_test_complete(bus);
+  KUNIT_EXPECT_EQ(test, bus->buf[6], 0x30);
+  KUNIT_EXPECT_EQ(test, ring->tail, 3);
+
+  /* Dry: the stream idles once, and the driver is told to hand back the motors */
+  skx_test_complete(bus);
+  KUNIT_EXPECT_FALSE(test, bus->out.active);
+  KUNIT_EXPECT_FALSE(test, bus->haptic.playing);
+  KUNIT_EXPECT_EQ(test, bus->haptic_dry, 1);
+
+  skx_test_send(bus);
+  KUNIT_EXPECT_FALSE(test, bus->out.active);
+  KUNIT_EXPECT_EQ(test, bus->haptic_dry, 1);
+
+  /* A head more than a ring ahead of tail is not trusted */
+  smp_store_release(&ring->head, 3 + SKX_HAPTIC_FRAMES + 1);
+  skx_test_send(bus);
+  KUNIT_EXPECT_FALSE(test, bus->out.active);
+  KUNIT_EXPECT_EQ(test, ring->tail, 3);
+}
+
+/*
+  The stress case: FF updates, acks and a haptic stream from their own
+  kthreads, a bus kthread completing packets and now and then pausing
+  and restarting the output as an interval change does. Everything the
+  bus sees is checked as it goes out.
+*/
+struct skx_test_stress {
+  spinlock_t lock;  /* output_data_lock */
+  struct skx_test_bus *bus;
+  atomic_t producers;
+  unsigned int requests;
+  unsigned int acks;
+  unsigned int frames;
+
+  u32 acks_dropped;
+
+  /* Checked by the bus */
+  u8 expect_serial;
+  u32 last_ack, last_ff;
+  u64 acks_sent, ff_sent, frames_sent, packets, pauses;
+  const char *failed;
+};
+
+static int skx_test_ff_thread(void *arg)
+{
+  struct skx_test_stress *s = arg;
+  struct output_packet *packet;
+  /* repeat tells these from haptic frames */
+  struct skx_rumble r = { .on = 0xFF, .repeat = 1 };
+  unsigned long flags;
+  bool pending;
+  u32 i;
+
+  for (i = 1; i <= s->requests; i++) {
+    spin_lock_irqsave(&s->lock, flags);
+
+    /* Two motor bytes carry the request number */
+    r.motors[0] = i;
+    r.motors[1] = i >> 8;
+    packet = skx_out_queue(s->bus->out.queues, SKX_OUT_FF, &pending);
+    packet->len = skx_build_rumble(packet->data, &r);
+    skx_test_send(s->bus);
+
+    spin_unlock_irqrestore(&s->lock, flags);
+    cond_resched();
+  }
+
+  atomic_dec(&s->producers);
+  return 0;
+}
+
+static int skx_test_ack_thread(void *arg)
+{
+  struct skx_test_stress *s = arg;
+  struct output_packet *packet;
+  unsigned long flags;
+  bool pending;
+  u32 i;
+
+  for (i = 1; i <= s->acks; i++) {
+    spin_lock_irqsave(&s->lock, flags);
+
+    packet = skx_out_queue(s->bus->out.queues, SKX_OUT_ACK, &pending);
+    if (packet) {
+      memset(packet->data, 0, ACK_LEN);
+      packet->data[0] = 0x01;
+      packet->data[2] = i;
+      packet->data[9] = i;
+      packet->data[10] = i >> 8;
+      packet->len = ACK_LEN;
+      skx_test_send(s->bus);
+    } else {
+      s->acks_dropped++;
+    }
+
+    spin_unlock_irqrestore(&s->lock, flags);
+    cond_resched();
+  }
+
+  atomic_dec(&s->producers);
+  return 0;
+}
+
+/* Userspace's side of the ring, in bursts of up to a quarter of it */
+static int skx_test_haptic_thread(void *arg)
+{
+  struct skx_test_stress *s = arg;
+  struct skx_haptic_ring *ring = s->bus->haptic.ring;
+  unsigned long flags;
+  u32 head = 0, burst;
+
+  while (head < s->frames) {
+    burst = min_t(u32, s->frames - head, head % (SKX_HAPTIC_FRAMES / 4) + 1);
+
+    for (; burst; burst--, head++) {
+      while (head - smp_load_acquire(&ring->tail) == SKX_HAPTIC_FRAMES)
+        cond_resched();
+
+      /* All four motors carry the frame number */
+      memset(ring->frame[head % SKX_HAPTIC_FRAMES].motors, head % MOTOR_MAX + 1, SKX_MOTORS);
+      smp_store_release(&ring->head, head + 1);
+    }
+
+    /* The write() that kicks an idle stream */
+    spin_lock_irqsave(&s->lock, flags);
+    skx_test_send(s->bus);
+    spin_unlock_irqrestore(&s->lock, flags);
+    cond_resched();
+  }
+
+  atomic_dec(&s->producers);
+  return 0;
+}
+
+static void skx_test_check(struct skx_test_stress *s)
+{
+  const u8 *buf = s->bus->buf;
+  u32 id;
+
+  s->packets++;
+
+  if (buf[0] != 0x01) {
+    if (buf[2] != s->expect_serial)
+      s->failed = "sequence number skipped or repeated";
+    s->expect_serial++;
+  }
+
+  switch (buf[0]) {
+    case 0x01:
+      id = buf[9] | buf[10] << 8;
+      if (id <= s->last_ack || buf[2] != (u8)id)
+        s->failed = "ack out of order or restamped";
+      s->last_ack = id;
+      s->acks_sent++;
+      break;
+    case 0x09:
+      if (!buf[12]) {
+        id = buf[6];
+        if (id != s->frames_sent % MOTOR_MAX + 1 || memchr_inv(buf + 6, id, SKX_MOTORS))
+          s->failed = "haptic frame skipped, repeated or torn";
+        s->frames_sent++;
+        break;
+      }
+      id = buf[6] | buf[7] << 8;
+      if (id <= s->last_ff)
+        s->failed = "rumble update out of order";
+      s->last_ff = id;
+      s->ff_sent++;
+      break;
+    default:
+      s->failed = "unknown packet";
+  }
+}
+
+static int skx_test_bus_thread(void *arg)
+{
+  struct skx_test_stress *s = arg;
+  struct skx_test_bus *bus = s->bus;
+  unsigned long flags;
+  bool idle;
+
+  for (;;) {
+    spin_lock_irqsave(&s->lock, flags);
+
+    idle = !bus->out.active;
+    if (!idle) {
+      skx_test_check(s);
+
+      if (s->packets % SKX_TEST_PAUSE_EVERY == 0) {
+        /* Held back over a completion, then restarted by hand */
+        bus->out.paused = true;
+        skx_test_complete(bus);
+        if (bus->out.active)
+          s->failed = "packet taken while paused";
+        s->pauses++;
+
+        spin_unlock_irqrestore(&s->lock, flags);
+        cond_resched();
+        spin_lock_irqsave(&s->lock, flags);
+
+        bus->out.paused = false;
+        bus->out.active = false;
+        skx_test_send(bus);
+      } else {
+        skx_test_complete(bus);
+      }
+    }
+
+    spin_unlock_irqrestore(&s->lock, flags);
+
+    if (idle && !atomic_read(&s->producers))
+      break;
+    cond_resched();
+  }
+
+  return 0;
+}
+
+static struct task_struct *skx_test_run(struct kunit *test, int (*fn)(void *),
+    struct skx_test_stress *s, const char *name)
+{
+  struct task_struct *task;
+
+  task = kthread_run(fn, s, "%s", name);
+  KUNIT_ASSERT_NOT_ERR_OR_NULL(test, task);
+  get_task_struct(task);
+
+  return task;
+}
+
+static void skx_test_join(struct task_struct *task)
+{
+  kthread_stop(task);
+  put_task_struct(task);
+}
+
+static void skx_test_stress(struct kunit *test)
+{
+  struct skx_test_stress *s;
+  struct task_struct *ff, *ack, *haptic, *bus;
+  ktime_t start;
+  s64 ms;
+
+  s = kunit_kzalloc(test, sizeof(*s), GFP_KERNEL);
+  KUNIT_ASSERT_NOT_ERR_OR_NULL(test, s);
+  spin_lock_init(&s->lock);
+  s->bus = skx_test_bus_alloc(test);
+  s->requests = SKX_TEST_REQUESTS;
+  s->acks = SKX_TEST_REQUESTS / 8;
+  s->frames = SKX_TEST_REQUESTS / 4;
+  atomic_set(&s->producers, 3);
+
+  start = ktime_get();
+
+  bus = skx_test_run(test, skx_test_bus_thread, s, "skx_test_bus");
+  ff = skx_test_run(test, skx_test_ff_thread, s, "skx_test_ff");
+  ack = skx_test_run(test, skx_test_ack_thread, s, "skx_test_ack");
+  haptic = skx_test_run(test, skx_test_haptic_thread, s, "skx_test_haptic");
+
+  skx_test_join(ff);
+  skx_test_join(ack);
+  skx_test_join(haptic);
+  skx_test_join(bus);
+
+  ms = ktime_ms_delta(ktime_get(), start);
+
+  kunit_info(test, "%llu packets (%llu acks, %u dropped, %llu rumble, %llu haptic), %llu pauses, %lld ms\n",
+      s->packets, s->acks_sent, s->acks_dropped, s->ff_sent, s->frames_sent, s->pauses, ms);
+
+  KUNIT_EXPECT_FALSE_MSG(test, s->failed, "%s", s->failed);
+  KUNIT_EXPECT_EQ(test, s->acks_sent + s->acks_dropped, s->acks);
+  KUNIT_EXPECT_EQ(test, s->last_ff, s->requests);
+  KUNIT_EXPECT_EQ(test, s->frames_sent, s->frames);
+  KUNIT_EXPECT_FALSE(test, s->bus->haptic.playing);
+  KUNIT_EXPECT_EQ(test, skx_out_depth(s->bus->out.queues), 0);
+  KUNIT_EXPECT_LT(test, ms, SKX_TEST_STRESS_MS);
+}
+
+static struct kunit_case skx_proto_test_cases[] = {
+  KUNIT_CASE(skx_test_handshake),
+  KUNIT_CASE(skx_test_class_order),
+  KUNIT_CASE(skx_test_ff_replace),
+  KUNIT_CASE(skx_test_ack_full),
+  KUNIT_CASE(skx_test_paused),
+  KUNIT_CASE(skx_test_submit_failed),
+  KUNIT_CASE(skx_test_haptic),
+  KUNIT_CASE_SLOW(skx_test_stress),
+  {}
+};
+
+static struct kunit_suite skx_proto_test_suite = {
+  .name = "skx_out",
+  .test_cases = skx_proto_test_cases,
+};
+
+kunit_test_suite(skx_proto_test_suite);
+
+MODULE_DESCRIPTION("KUnit tests for the skx output state machine");
+MODULE_LICENSE("GPL");
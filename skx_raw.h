@@ -0,0 +1,73 @@
+#ifndef SKX_RAW_H
+#define SKX_RAW_H
+
+#include <linux/types.h>
+
+/*
+  Layout of the ring behind /dev/skxraw<n>, shared by the driver and the
+  programs reading it. Map it read-only from offset 0, sizeof(struct
+  skx_raw_ring) rounded up to a page.
+
+  The driver is the only writer: it fills slot head % SKX_RAW_SLOTS and
+  then increments head with release semantics. Each reader keeps its own
+  tail. Load head with acquire semantics, copy out slots tail..head-1,
+  then load head again: a slot that is now more than SKX_RAW_SLOTS behind
+  it may have been overwritten while it was copied and has to be dropped,
+  as do reports the reader fell more than SKX_RAW_SLOTS behind on.
+
+  poll() reports POLLIN when reports arrived since it last did, so drain
+  the ring between two calls. POLLHUP means the pad is gone.
+*/
+#define SKX_RAW_SLOTS 256
+#define SKX_RAW_REPORT 64
+
+struct skx_raw_slot {
+  __u64 timestamp;  /* input URB completion, CLOCK_MONOTONIC ns */
+  __u32 seq;        /* head when this slot was written */
+  __u16 len;        /* bytes the pad actually sent */
+  __u16 reserved;
+  __u8 data[SKX_RAW_REPORT];
+};
+
+struct skx_raw_ring {
+  __u32 head;       /* reports written so far */
+  __u32 slots;      /* SKX_RAW_SLOTS */
+  __u32 slot_size;  /* sizeof(struct skx_raw_slot) */
+  __u32 reserved[13];
+  struct skx_raw_slot slot[SKX_RAW_SLOTS];
+};
+
+/*
+  The other way round: a ring of motor frames, mapped read-write from
+  offset SKX_HAPTIC_OFFSET, that the driver plays one per OUT interval
+  straight from the OUT URB's completion, whenever no ack, handshake or
+  force feedback packet is waiting.
+
+  Userspace is the only writer of frames and head: fill frame head %
+  SKX_HAPTIC_FRAMES, then increment head with release semantics, never
+  getting more than SKX_HAPTIC_FRAMES ahead of tail. The driver
+  increments tail, with release semantics, as frames go out.
+
+  A frame runs the motors until the next one. When the ring runs dry the
+  motors go back to whatever force feedback effects are playing (off if
+  none are) and the stream goes idle until a write() to the
+  device (of anything) kicks it again; as long as frames are written
+  ahead of tail no system call is needed. poll() reports POLLOUT while
+  at least half of the ring is free.
+*/
+#define SKX_HAPTIC_OFFSET 0x100000
+#define SKX_HAPTIC_FRAMES 1024
+
+struct skx_haptic_frame {
+  __u8 motors[4];   /* left trigger, right trigger, heavy, light: 0..100 */
+};
+
+struct skx_haptic_ring {
+  __u32 head;       /* frames written so far */
+  __u32 tail;       /* frames played so far */
+  __u32 frames;     /* SKX_HAPTIC_FRAMES */
+  __u32 reserved[13];
+  struct skx_haptic_frame frame[SKX_HAPTIC_FRAMES];
+};
+
+#endif
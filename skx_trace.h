@@ -0,0 +1,153 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM skx
+
+#if !defined(_SKX_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SKX_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/usb.h>
+
+/*
+  Every event names the pad by USB bus and device number and carries the
+  GIP command and sequence byte (data[0] and data[2]) of the packet it is
+  about: the pad's sequence for input reports and acks, out.serial for
+  everything we send.
+*/
+
+DECLARE_EVENT_CLASS(skx_urb,
+  TP_PROTO(struct usb_device *udev, int status, const u8 *data, u32 len),
+  TP_ARGS(udev, status, data, len),
+
+  TP_STRUCT__entry(
+    __field(int, busnum)
+    __field(int, devnum)
+    __field(int, status)
+    __field(u8, cmd)
+    __field(u8, seq)
+    __field(u32, len)
+  ),
+
+  TP_fast_assign(
+    __entry->busnum = udev->bus->busnum;
+    __entry->devnum = udev->devnum;
+    __entry->status = status;
+    __entry->cmd = data[0];
+    __entry->seq = data[2];
+    __entry->len = len;
+  ),
+
+  TP_printk("%d-%d status=%d cmd=0x%02x seq=%u len=%u",
+    __entry->busnum, __entry->devnum, __entry->status,
+    __entry->cmd, __entry->seq, __entry->len)
+);
+
+DEFINE_EVENT(skx_urb, skx_in_urb_complete,
+  TP_PROTO(struct usb_device *udev, int status, const u8 *data, u32 len),
+  TP_ARGS(udev, status, data, len)
+);
+
+DEFINE_EVENT(skx_urb, skx_out_urb_submit,
+  TP_PROTO(struct usb_device *udev, int status, const u8 *data, u32 len),
+  TP_ARGS(udev, status, data, len)
+);
+
+DEFINE_EVENT(skx_urb, skx_out_urb_complete,
+  TP_PROTO(struct usb_device *udev, int status, const u8 *data, u32 len),
+  TP_ARGS(udev, status, data, len)
+);
+
+DECLARE_EVENT_CLASS(skx_report,
+  TP_PROTO(struct usb_device *udev, const u8 *data),
+  TP_ARGS(udev, data),
+
+  TP_STRUCT__entry(
+    __field(int, busnum)
+    __field(int, devnum)
+    __field(u8, cmd)
+    __field(u8, seq)
+  ),
+
+  TP_fast_assign(
+    __entry->busnum = udev->bus->busnum;
+    __entry->devnum = udev->devnum;
+    __entry->cmd = data[0];
+    __entry->seq = data[2];
+  ),
+
+  TP_printk("%d-%d cmd=0x%02x seq=%u",
+    __entry->busnum, __entry->devnum, __entry->cmd, __entry->seq)
+);
+
+DEFINE_EVENT(skx_report, skx_report_decoded,
+  TP_PROTO(struct usb_device *udev, const u8 *data),
+  TP_ARGS(udev, data)
+);
+
+DEFINE_EVENT(skx_report, skx_input_sync,
+  TP_PROTO(struct usb_device *udev, const u8 *data),
+  TP_ARGS(udev, data)
+);
+
+TRACE_EVENT(skx_ff_request,
+  TP_PROTO(struct usb_device *udev, int effect_id, int value, u8 serial),
+  TP_ARGS(udev, effect_id, value, serial),
+
+  TP_STRUCT__entry(
+    __field(int, busnum)
+    __field(int, devnum)
+    __field(int, effect_id)
+    __field(int, value)
+    __field(u8, seq)
+  ),
+
+  TP_fast_assign(
+    __entry->busnum = udev->bus->busnum;
+    __entry->devnum = udev->devnum;
+    __entry->effect_id = effect_id;
+    __entry->value = value;
+    __entry->seq = serial;
+  ),
+
+  /* seq is the out.serial the next packet sent will carry */
+  TP_printk("%d-%d effect=%d value=%d seq=%u",
+    __entry->busnum, __entry->devnum, __entry->effect_id,
+    __entry->value, __entry->seq)
+);
+
+TRACE_EVENT(skx_packet_queued,
+  TP_PROTO(struct usb_device *udev, int cls, const u8 *data, u32 len, int depth),
+  TP_ARGS(udev, cls, data, len, depth),
+
+  TP_STRUCT__entry(
+    __field(int, busnum)
+    __field(int, devnum)
+    __field(int, cls)
+    __field(u8, cmd)
+    __field(u8, seq)
+    __field(u32, len)
+    __field(int, depth)
+  ),
+
+  TP_fast_assign(
+    __entry->busnum = udev->bus->busnum;
+    __entry->devnum = udev->devnum;
+    __entry->cls = cls;
+    __entry->cmd = data[0];
+    __entry->seq = data[2];
+    __entry->len = len;
+    __entry->depth = depth;
+  ),
+
+  /* seq is only final for acks, out.serial is stamped when sent */
+  TP_printk("%d-%d class=%d cmd=0x%02x seq=%u len=%u depth=%d",
+    __entry->busnum, __entry->devnum, __entry->cls, __entry->cmd,
+    __entry->seq, __entry->len, __entry->depth)
+);
+
+#endif /* _SKX_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE skx_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,133 @@
+#ifndef SKX_KCOMPAT_H
+#define SKX_KCOMPAT_H
+
+/*
+  Userspace stand-ins for the kernel helpers skx_proto.h relies on. They
+  follow the kernel definitions closely enough that the benchmark runs
+  the same instructions the module does, fixp_sin16() included.
+*/
+
+#include <endian.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/input.h>
+#include <linux/types.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+#ifndef __always_inline
+#define __always_inline inline __attribute__((__always_inline__))
+#endif
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) min((t)(a), (t)(b))
+#define clamp(v, lo, hi) min(max(v, lo), hi)
+#define clamp_t(t, v, lo, hi) clamp((t)(v), (t)(lo), (t)(hi))
+
+static inline unsigned long int_sqrt(unsigned long x)
+{
+  return sqrt((double)x);
+}
+
+#define le16_to_cpup(p) le16toh(*(const uint16_t *)(p))
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+  return dividend / divisor;
+}
+
+static inline void *memchr_inv(const void *start, int c, size_t bytes)
+{
+  const u8 *p = start;
+  size_t i;
+
+  for (i = 0; i < bytes; i++)
+    if (p[i] != (u8)c)
+      return (void *)(p + i);
+
+  return NULL;
+}
+
+/* ktime_t is plain nanoseconds, as in the kernel */
+typedef s64 ktime_t;
+#define KTIME_MAX ((s64)~((u64)1 << 63))
+#define NSEC_PER_MSEC 1000000LL
+
+static inline ktime_t ktime_add(ktime_t a, ktime_t b) { return a + b; }
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b) { return a - b; }
+static inline ktime_t ktime_add_ms(ktime_t kt, u64 ms) { return kt + ms * NSEC_PER_MSEC; }
+static inline bool ktime_before(ktime_t a, ktime_t b) { return a < b; }
+static inline s64 ktime_ms_delta(ktime_t later, ktime_t earlier) { return (later - earlier) / NSEC_PER_MSEC; }
+
+/* Bitmaps, enough for FF_EFFECTS bits */
+#define BITS_PER_LONG (sizeof(long) * CHAR_BIT)
+#define BITS_TO_LONGS(n) (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits) unsigned long name[BITS_TO_LONGS(bits)]
+
+static inline void __set_bit(int nr, unsigned long *addr) { addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG); }
+static inline void __clear_bit(int nr, unsigned long *addr) { addr[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG)); }
+static inline bool test_bit(int nr, const unsigned long *addr) { return addr[nr / BITS_PER_LONG] & (1UL << (nr % BITS_PER_LONG)); }
+
+static inline int find_next_bit(const unsigned long *addr, int size, int offset)
+{
+  for (; offset < size; offset++)
+    if (test_bit(offset, addr))
+      return offset;
+  return size;
+}
+
+#define find_first_bit(addr, size) find_next_bit((addr), (size), 0)
+
+#define for_each_set_bit(bit, addr, size) \
+  for ((bit) = find_next_bit((addr), (size), 0); \
+       (bit) < (size); \
+       (bit) = find_next_bit((addr), (size), (bit) + 1))
+
+/* The ring barriers, as the C11 atomics they correspond to */
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define smp_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* Same table and folding as <linux/fixp-arith.h>, filled in at startup */
+static s32 skx_sin_table[91];
+
+static void __attribute__((constructor)) skx_init_sin_table(void)
+{
+  int i;
+
+  for (i = 0; i <= 90; i++)
+    skx_sin_table[i] = (s32)(sin(i * M_PI / 180) * 0x7FFFFFFF);
+}
+
+static inline s32 fixp_sin32(int degrees)
+{
+  bool negative = false;
+  s32 ret;
+
+  degrees = (degrees % 360 + 360) % 360;
+  if (degrees > 180) {
+    negative = true;
+    degrees -= 180;
+  }
+  if (degrees > 90)
+    degrees = 180 - degrees;
+
+  ret = skx_sin_table[degrees];
+  return negative ? -ret : ret;
+}
+
+#define fixp_sin16(v) (fixp_sin32(v) >> 16)
+
+#endif
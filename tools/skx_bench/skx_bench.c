@@ -0,0 +1,905 @@
+/*
+  Replays input reports and force feedback requests through the decoder
+  and FF engine of the module (skx_proto.h) and reports how long they
+  take, without a pad or even the module loaded.
+
+  Input reports are read from a capture of raw 64 byte packets, back to
+  back, as the pad sends them on its IN endpoint (e.g. cut out of a
+  usbmon trace). Without one, a synthetic capture of stick sweeps with
+  sensor noise and button presses is used. -c shapes both sticks with a
+  radial or axial deadzone and curve, the way the left_stick/right_stick
+  attributes do, to see what the table lookups cost.
+
+  With -q, the module's OUT state machine (skx_out_send() and
+  skx_out_complete()) is hammered from an FF thread, an ack thread, a
+  haptic stream writer and a thread pausing the output the way an interval
+  change does, while another thread plays the host controller and
+  completes each packet. Every packet that goes out is checked: the
+  handshake's ack and power on once each and in that order, acks and
+  rumble updates in the order they were queued, no ack lost unless its
+  queue was full, our sequence number counting up without gaps, every
+  haptic frame played once, the stream going idle when it runs dry, and
+  the last rumble update delivered.
+*/
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "kcompat.h"
+#include "../../skx_proto.h"
+
+#define SYNTH_REPORTS 4096
+
+struct bench_input {
+  int abs[ABS_CNT];   /* what input_abs_get_val() would return */
+  u64 events;
+};
+
+static void bench_emit(void *ctx, unsigned int type, unsigned int code, int value, bool changed)
+{
+  struct bench_input *in = ctx;
+
+  if (type == EV_ABS) {
+    if (!changed && in->abs[code] == value)
+      return;
+    in->abs[code] = value;
+  }
+
+  in->events++;
+}
+
+static u64 now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static u8 *load_capture(const char *path, size_t *count)
+{
+  FILE *f;
+  u8 *buf = NULL;
+  size_t len = 0, n;
+
+  f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return NULL;
+  }
+
+  for (;;) {
+    buf = realloc(buf, len + PKT_LEN * 256);
+    n = fread(buf + len, 1, PKT_LEN * 256, f);
+    len += n;
+    if (n < PKT_LEN * 256)
+      break;
+  }
+  fclose(f);
+
+  *count = len / PKT_LEN;
+  if (!*count) {
+    fprintf(stderr, "%s: no complete %d byte packets\n", path, PKT_LEN);
+    free(buf);
+    return NULL;
+  }
+
+  return buf;
+}
+
+static void put_le16(u8 *p, u16 v)
+{
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+static u8 *synth_capture(size_t *count)
+{
+  u8 *buf = calloc(SYNTH_REPORTS, PKT_LEN);
+  u8 *p;
+  size_t i;
+  int noise;
+
+  for (i = 0; i < SYNTH_REPORTS; i++) {
+    p = buf + i * PKT_LEN;
+
+    /* The guide button every now and then */
+    if (i % 512 == 511) {
+      p[0] = 0x07;
+      p[1] = 0x30;
+      p[2] = i;
+      p[3] = 0x02;
+      p[4] = (i / 512) & 1;
+      continue;
+    }
+
+    p[0] = 0x20;
+    p[2] = i;
+    p[3] = 0x0E;
+    p[4] = (i / 64) % 3 == 0 ? 0x10 : 0x00;
+    p[5] = (i / 96) % 4 == 0 ? 0x01 : 0x00;
+
+    /* Triggers ramp, the left stick sweeps, the right one rests and jitters */
+    noise = (int)(rand() % 64) - 32;
+    put_le16(p + 6, (i * 4) % 1024);
+    put_le16(p + 8, 0);
+    put_le16(p + 10, (u16)(s16)(fixp_sin16(i % 360) + noise));
+    put_le16(p + 12, (u16)(s16)(fixp_sin16((i + 90) % 360) + noise));
+    put_le16(p + 14, (u16)(s16)noise);
+    put_le16(p + 16, (u16)(s16)-noise);
+  }
+
+  *count = SYNTH_REPORTS;
+  return buf;
+}
+
+/* A typical shooter setup: 12% deadzone, 3% anti-deadzone, softer near the centre */
+static struct skx_stick_curve *bench_curves(const char *mode)
+{
+  static struct skx_stick_curve sticks[SKX_STICKS];
+  struct skx_stick_config config = {
+    .deadzone = 4000,
+    .anti_deadzone = 1000,
+    .points = 1,
+    .curve_in = { 16384 },
+    .curve_out = { 8192 },
+  };
+  unsigned int i;
+
+  if (!strcmp(mode, "axial"))
+    config.mode = SKX_STICK_AXIAL;
+  else if (!strcmp(mode, "radial"))
+    config.mode = SKX_STICK_RADIAL;
+  else
+    return NULL;
+
+  for (i = 0; i < SKX_STICKS; i++) {
+    sticks[i].config = config;
+    skx_curve_build(&sticks[i]);
+  }
+
+  return sticks;
+}
+
+/*
+  A profile touching every kind of remap: A and B swapped, the Y axes
+  inverted, X and Y on the D-pad's X axis and the bumpers left out.
+*/
+static const struct skx_keymap *bench_keymap(void)
+{
+  static struct skx_keymap map;
+  unsigned int i;
+  int err = 0;
+
+  skx_keymap_reset(&map);
+
+  for (i = 0; i < SKX_REPORT_FIELDS; i++) {
+    switch (skx_report_fields[i].code) {
+      case BTN_A:
+        err |= skx_keymap_set(&map, i, EV_KEY, BTN_B, false);
+        break;
+      case BTN_B:
+        err |= skx_keymap_set(&map, i, EV_KEY, BTN_A, false);
+        break;
+      case BTN_X:
+        err |= skx_keymap_set(&map, i, EV_ABS, ABS_HAT0X, true);
+        break;
+      case BTN_Y:
+        err |= skx_keymap_set(&map, i, EV_ABS, ABS_HAT0X, false);
+        break;
+      case BTN_TL:
+      case BTN_TR:
+        err |= skx_keymap_set(&map, i, 0, 0, false);
+        break;
+      case ABS_Y:
+      case ABS_RY:
+        err |= skx_keymap_set(&map, i, EV_ABS, skx_report_fields[i].code, true);
+        break;
+    }
+  }
+
+  return err ? NULL : &map;
+}
+
+static void bench_reports(const u8 *capture, size_t count, unsigned int passes,
+    const struct skx_stick_curve *curves, const struct skx_keymap *keymap)
+{
+  const struct skx_report_field *fields = keymap ? keymap->field : skx_report_fields;
+  struct bench_input in = { { 0 } };
+  u8 prev[REPORT_LEN] = { 0 };
+  u8 shaped[REPORT_LEN];
+  struct skx_gip_header hdr;
+  u64 start, elapsed, decoded = 0;
+  const u8 *data;
+  unsigned int pass;
+  size_t i;
+
+  start = now_ns();
+
+  for (pass = 0; pass < passes; pass++) {
+    for (i = 0; i < count; i++) {
+      data = capture + i * PKT_LEN;
+      if (!skx_gip_parse(data, PKT_LEN, &hdr))
+        continue;
+
+      switch (hdr.command) {
+        case GIP_CMD_GUIDE:
+          bench_emit(&in, EV_KEY, BTN_MODE, data[hdr.size] & 0x01, true);
+          in.events++;  /* SYN_REPORT */
+          decoded++;
+          break;
+        case GIP_CMD_INPUT:
+          if (curves) {
+            skx_shape_sticks(curves, data, shaped);
+            data = shaped;
+          }
+          skx_decode_fields(prev, data, fields, bench_emit, &in);
+          in.events++;
+          decoded++;
+          break;
+      }
+    }
+  }
+
+  elapsed = now_ns() - start;
+
+  printf("reports:   %zu in capture, %llu decoded\n", count, (unsigned long long)decoded);
+  if (!decoded)
+    return;
+  printf("           %.1f ns/report, %.2f events/report\n",
+      (double)elapsed / decoded, (double)in.events / decoded);
+}
+
+/* Effects the synthetic FF stream picks from, like a game would upload them */
+static void synth_effect(struct ff_effect *e, int id)
+{
+  memset(e, 0, sizeof(*e));
+  e->id = id;
+
+  switch (rand() % 7) {
+    case 0:
+      e->type = FF_RUMBLE;
+      e->u.rumble.strong_magnitude = rand() & 0xFFFF;
+      e->u.rumble.weak_magnitude = rand() & 0xFFFF;
+      e->direction = (rand() % 4) << 14;  /* body or trigger motors */
+      e->replay.length = 50 + rand() % 500;
+      break;
+    case 1:
+      e->type = FF_RUMBLE;
+      e->u.rumble.strong_magnitude = 0xC000;
+      e->replay.length = 0;  /* until stopped */
+      break;
+    case 2:
+      e->type = FF_CONSTANT;
+      e->u.constant.level = rand() & 0x7FFF;
+      e->u.constant.envelope.attack_length = 100;
+      e->u.constant.envelope.fade_length = 200;
+      e->replay.length = 600;
+      break;
+    case 3:
+      e->type = FF_PERIODIC;
+      e->u.periodic.waveform = FF_SINE;
+      e->u.periodic.magnitude = 0x6000;
+      e->u.periodic.period = 100 + rand() % 200;
+      e->replay.length = 1000;
+      break;
+    case 4:
+      e->type = FF_PERIODIC;
+      e->u.periodic.waveform = rand() % 2 ? FF_SQUARE : FF_SAW_DOWN;
+      e->u.periodic.magnitude = 0x7FFF;
+      e->u.periodic.period = 50;
+      e->replay.length = 300;
+      e->replay.delay = rand() % 50;
+      break;
+    case 5:
+      /* Buzz, buzz, buzz: played with a count, see bench_ff() */
+      e->type = FF_RUMBLE;
+      e->u.rumble.strong_magnitude = 0x8000;
+      e->u.rumble.weak_magnitude = 0x8000;
+      e->replay.length = 100;
+      e->replay.delay = 100;
+      break;
+    case 6:
+      e->type = FF_PERIODIC;
+      e->u.periodic.waveform = FF_SQUARE;
+      e->u.periodic.magnitude = 0x5000;
+      e->u.periodic.period = 80;
+      e->replay.length = 640;
+      break;
+  }
+}
+
+/* Steps the engine until until, as the module's hrtimer would */
+static void run_engine(struct skx_ff_engine *ff, ktime_t *next, ktime_t until,
+    u64 *steps, u64 *packets)
+{
+  struct skx_rumble r;
+  u8 pkt[PKT_LEN];
+
+  while (*next <= until) {
+    (*steps)++;
+    if (skx_ff_step(ff, *next, &r, next)) {
+      skx_build_rumble(pkt, &r);
+      (*packets)++;
+    }
+  }
+}
+
+static void bench_ff(unsigned int requests, unsigned int period_us)
+{
+  static struct skx_ff_engine ff;
+  struct skx_ff_voice *v;
+  struct ff_effect effect;
+  struct skx_rumble rumble;
+  u8 pkt[PKT_LEN];
+  u64 start, elapsed, steps = 0, packets = 0;
+  ktime_t now = 0, next = KTIME_MAX;
+  unsigned int r;
+  int id;
+
+  memset(&ff, 0, sizeof(ff));
+  ff.gain = 0xFFFF;
+  ff.period = period_us * 1000LL;
+
+  start = now_ns();
+
+  for (r = 0; r < requests; r++) {
+    /* The next request lands 0-50ms after the previous one */
+    now += (rand() % 50000) * 1000LL;
+    run_engine(&ff, &next, now, &steps, &packets);
+
+    id = rand() % FF_EFFECTS;
+    v = &ff.voices[id];
+
+    if (test_bit(id, ff.active) && rand() % 3) {
+      /* Stop it, as skx_ff_playback() with a zero value */
+      __clear_bit(id, ff.active);
+    } else {
+      /* Upload and play, as skx_ff_upload() and skx_ff_playback() */
+      synth_effect(&effect, id);
+      v->effect = effect;
+      skx_ff_compile(v);
+      v->start = now;
+      v->count = effect.replay.delay == 100 ? 3 : 1 + rand() % 2;
+      __set_bit(id, ff.active);
+    }
+
+    steps++;
+    if (skx_ff_step(&ff, now, &rumble, &next)) {
+      skx_build_rumble(pkt, &rumble);
+      packets++;
+    }
+  }
+
+  /* Let everything still playing run out */
+  for (id = 0; id < FF_EFFECTS; id++)
+    if (!ff.voices[id].effect.replay.length)
+      __clear_bit(id, ff.active);
+  run_engine(&ff, &next, now + 60 * 1000 * NSEC_PER_MSEC, &steps, &packets);
+
+  elapsed = now_ns() - start;
+
+  printf("ff:        %u requests, %llu engine steps, %llu packets, %.1f s simulated\n",
+      requests, (unsigned long long)steps, (unsigned long long)packets, now / 1e9);
+  if (!requests || !steps)
+    return;
+  printf("           %.1f ns/step, %.2f packets/request\n",
+      (double)elapsed / steps, (double)packets / requests);
+}
+
+/*
+  A spring and a damper held while the capture plays back, one report per
+  millisecond, as skx_gip_input() feeds them
+*/
+static void bench_conditions(const u8 *capture, size_t count, unsigned int period_us)
+{
+  static struct skx_ff_engine ff;
+  struct skx_ff_voice *v;
+  struct skx_gip_header hdr;
+  struct skx_rumble rumble;
+  u8 pkt[PKT_LEN];
+  u64 start, elapsed, reports = 0, steps = 0, packets = 0;
+  ktime_t now = 0, next, held;
+  const u8 *data;
+  size_t i;
+  int id, a;
+
+  memset(&ff, 0, sizeof(ff));
+  ff.gain = 0xFFFF;
+  ff.period = period_us * 1000LL;
+
+  for (id = 0; id < 2; id++) {
+    v = &ff.voices[id];
+    v->effect.type = id ? FF_DAMPER : FF_SPRING;
+    for (a = 0; a < 2; a++) {
+      v->effect.u.condition[a].right_saturation = 0xFFFF;
+      v->effect.u.condition[a].left_saturation = 0xFFFF;
+      v->effect.u.condition[a].right_coeff = 0x4000;
+      v->effect.u.condition[a].left_coeff = 0x4000;
+      v->effect.u.condition[a].deadband = 0x800;
+    }
+    v->count = 1;
+    skx_ff_condition(&ff.pad, v, v->weights);
+    __set_bit(id, ff.active);
+  }
+  skx_ff_step(&ff, now, &rumble, &next);
+
+  start = now_ns();
+
+  for (i = 0; i < count; i++) {
+    now += NSEC_PER_MSEC;
+    run_engine(&ff, &next, now, &steps, &packets);
+
+    data = capture + i * PKT_LEN;
+    if (!skx_gip_parse(data, PKT_LEN, &hdr) || hdr.command != GIP_CMD_INPUT)
+      continue;
+
+    reports++;
+    held = skx_ff_track(&ff, data, now);
+    if (held <= now) {
+      steps++;
+      if (skx_ff_step(&ff, now, &rumble, &next)) {
+        skx_build_rumble(pkt, &rumble);
+        packets++;
+      }
+    } else {
+      next = min(next, held);
+    }
+  }
+
+  elapsed = now_ns() - start;
+
+  printf("condition: %llu reports, %llu engine steps, %llu packets\n",
+      (unsigned long long)reports, (unsigned long long)steps, (unsigned long long)packets);
+  if (!reports)
+    return;
+  printf("           %.1f ns/report, %.3f packets/report\n",
+      (double)elapsed / reports, (double)packets / reports);
+}
+
+struct bench_out {
+  pthread_mutex_t lock;      /* output_data_lock */
+  pthread_cond_t submitted;  /* a packet went in flight, or done */
+  pthread_cond_t idle;       /* nothing is in flight */
+  pthread_cond_t room;       /* a haptic frame was taken, or the stream ran dry */
+  struct skx_out out;
+  struct skx_haptic_stream haptic;
+  struct skx_haptic_ring ring;
+  u8 data[PKT_LEN];          /* output_data */
+  bool done;
+  unsigned int requests;
+  unsigned int acks;
+  unsigned int frames;
+  unsigned int pauses;
+
+  u32 acks_dropped;
+  u64 ops;
+  unsigned int hs_waits, dry;
+
+  /* Checked by the completion thread */
+  u8 expect_serial;
+  u32 last_ack, last_ff;
+  u64 acks_sent, ff_sent, frames_sent, identify_acks, power_ons, packets;
+  const char *failed;
+};
+
+static void put_le32(u8 *p, u32 v)
+{
+  put_le16(p, v & 0xFFFF);
+  put_le16(p + 2, v >> 16);
+}
+
+static u32 get_le32(const u8 *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+}
+
+/* As skx_out_submit(), with output_data_lock held; hc_thread() is the bus */
+static void out_submit(struct bench_out *b, unsigned int todo)
+{
+  if (todo & SKX_OUT_HS_WAIT)
+    b->hs_waits++;
+  if (todo & (SKX_OUT_HAPTIC | SKX_OUT_HAPTIC_DRY))
+    pthread_cond_signal(&b->room);
+  if (todo & SKX_OUT_HAPTIC_DRY)
+    b->dry++;
+
+  if (todo & SKX_OUT_SUBMIT) {
+    if (b->out.paused)
+      b->failed = "packet submitted while paused";
+    pthread_cond_signal(&b->submitted);
+  }
+}
+
+/* As skx_send_packet() */
+static void out_send(struct bench_out *b)
+{
+  out_submit(b, skx_out_send(&b->out, b->data));
+}
+
+static void *ff_thread(void *arg)
+{
+  struct bench_out *b = arg;
+  struct output_packet *packet;
+  /* repeat tells these from haptic frames */
+  struct skx_rumble r = { .on = 0xFF, .repeat = 1 };
+  bool pending;
+  u32 i;
+
+  for (i = 1; i <= b->requests; i++) {
+    pthread_mutex_lock(&b->lock);
+
+    /* The motor bytes carry the request number */
+    put_le32(r.motors, i);
+    packet = skx_out_queue(b->out.queues, SKX_OUT_FF, &pending);
+    packet->len = skx_build_rumble(packet->data, &r);
+    b->ops++;
+    out_send(b);
+
+    pthread_mutex_unlock(&b->lock);
+    sched_yield();
+  }
+
+  return NULL;
+}
+
+static void *ack_thread(void *arg)
+{
+  struct bench_out *b = arg;
+  struct output_packet *packet;
+  bool pending;
+  u32 i;
+
+  for (i = 1; i <= b->acks; i++) {
+    pthread_mutex_lock(&b->lock);
+
+    /* Each ack stands for a message from the pad, so as skx_hs_report() */
+    if (b->out.hs_state == SKX_HS_WAIT)
+      b->out.hs_state = SKX_HS_READY;
+
+    packet = skx_out_queue(b->out.queues, SKX_OUT_ACK, &pending);
+    if (packet) {
+      memset(packet->data, 0, ACK_LEN);
+      packet->data[0] = 0x01;
+      packet->data[2] = i;
+      put_le32(packet->data + 9, i);
+      packet->len = ACK_LEN;
+      out_send(b);
+    } else {
+      b->acks_dropped++;
+    }
+    b->ops++;
+
+    pthread_mutex_unlock(&b->lock);
+    sched_yield();
+  }
+
+  return NULL;
+}
+
+/*
+  Userspace's side of the haptic ring: frames in bursts, each followed by
+  the write() that kicks the stream if it went idle. A burst is at most a
+  quarter of the ring, so it can't fill up before that kick.
+*/
+static void *haptic_thread(void *arg)
+{
+  struct bench_out *b = arg;
+  struct skx_haptic_ring *ring = &b->ring;
+  unsigned int seed = 1;
+  u32 head = 0, burst;
+
+  while (head < b->frames) {
+    burst = rand_r(&seed) % (SKX_HAPTIC_FRAMES / 4) + 1;
+    burst = min(burst, b->frames - head);
+
+    for (; burst; burst--, head++) {
+      if (head - smp_load_acquire(&ring->tail) == SKX_HAPTIC_FRAMES) {
+        pthread_mutex_lock(&b->lock);
+        while (head - ring->tail == SKX_HAPTIC_FRAMES)
+          pthread_cond_wait(&b->room, &b->lock);
+        pthread_mutex_unlock(&b->lock);
+      }
+
+      /* All four motors carry the frame number */
+      memset(ring->frame[head % SKX_HAPTIC_FRAMES].motors, head % MOTOR_MAX + 1, SKX_MOTORS);
+      smp_store_release(&ring->head, head + 1);
+    }
+
+    pthread_mutex_lock(&b->lock);
+    b->ops++;
+    out_send(b);
+
+    /* Every other burst, wait for the stream to run dry first */
+    if (rand_r(&seed) & 1)
+      while (b->haptic.playing)
+        pthread_cond_wait(&b->room, &b->lock);
+
+    pthread_mutex_unlock(&b->lock);
+    sched_yield();
+  }
+
+  return NULL;
+}
+
+/* Holds the output back and lets it go again, as skx_set_intervals() does */
+static void *pause_thread(void *arg)
+{
+  struct bench_out *b = arg;
+  unsigned int i, j;
+
+  for (i = 0; i < b->pauses; i++) {
+    for (j = 0; j < 100; j++)
+      sched_yield();
+
+    pthread_mutex_lock(&b->lock);
+    b->out.paused = true;
+    while (b->out.active)
+      pthread_cond_wait(&b->idle, &b->lock);
+    pthread_mutex_unlock(&b->lock);
+
+    /* The producers keep queueing meanwhile */
+    sched_yield();
+
+    pthread_mutex_lock(&b->lock);
+    b->out.paused = false;
+    b->out.active = false;
+    out_send(b);
+    b->ops++;
+    pthread_mutex_unlock(&b->lock);
+  }
+
+  return NULL;
+}
+
+/* What the pad sees, called with the lock held */
+static void out_check(struct bench_out *b)
+{
+  u32 id;
+
+  b->packets++;
+
+  /* Everything but the acks of the pad's messages carries our sequence number */
+  if (b->data[0] != 0x01 || b->data[1] == 0x20) {
+    if (b->data[2] != b->expect_serial)
+      b->failed = "sequence number skipped or repeated";
+    b->expect_serial++;
+  }
+
+  switch (b->data[0]) {
+    case 0x01:
+      if (b->data[1] == 0x20) {
+        b->identify_acks++;
+        break;
+      }
+      id = get_le32(b->data + 9);
+      if (id <= b->last_ack || b->data[2] != (u8)id)
+        b->failed = "ack out of order or restamped";
+      b->last_ack = id;
+      b->acks_sent++;
+      break;
+    case 0x05:
+      if (!b->identify_acks && !b->acks_sent)
+        b->failed = "power on before any ack";
+      b->power_ons++;
+      break;
+    case 0x09:
+      if (!b->data[12]) {
+        id = b->data[6];
+        if (id != b->frames_sent % MOTOR_MAX + 1 || memchr_inv(b->data + 6, id, SKX_MOTORS))
+          b->failed = "haptic frame skipped, repeated or torn";
+        b->frames_sent++;
+        break;
+      }
+      id = get_le32(b->data + 6);
+      if (id <= b->last_ff)
+        b->failed = "rumble update out of order";
+      b->last_ff = id;
+      b->ff_sent++;
+      break;
+    default:
+      b->failed = "unknown packet";
+  }
+}
+
+static void *hc_thread(void *arg)
+{
+  struct bench_out *b = arg;
+
+  pthread_mutex_lock(&b->lock);
+
+  for (;;) {
+    while (!b->out.active && !b->done)
+      pthread_cond_wait(&b->submitted, &b->lock);
+    if (!b->out.active)
+      break;
+
+    out_check(b);
+
+    /* As skx_interrupt_out() on success */
+    out_submit(b, skx_out_complete(&b->out, b->data));
+    if (!b->out.active)
+      pthread_cond_broadcast(&b->idle);
+
+    /* Let the producers in between completions, like a real bus would */
+    pthread_mutex_unlock(&b->lock);
+    sched_yield();
+    pthread_mutex_lock(&b->lock);
+  }
+
+  pthread_mutex_unlock(&b->lock);
+
+  return NULL;
+}
+
+static int bench_queue(unsigned int requests)
+{
+  static const u8 identify_ack[] = {
+    0x01, 0x20, 0x00, 0x09, 0x00,
+    0x04, 0x20, 0x3a, 0x00, 0x00,
+    0x00, 0x80, 0x00
+  };
+  static struct bench_out b;
+  pthread_t ff, ack, haptic, pause, hc;
+  u64 start, elapsed;
+
+  memset(&b, 0, sizeof(b));
+  pthread_mutex_init(&b.lock, NULL);
+  pthread_cond_init(&b.submitted, NULL);
+  pthread_cond_init(&b.idle, NULL);
+  pthread_cond_init(&b.room, NULL);
+  b.requests = requests;
+  /* The pad asks for an ack far less often than rumble changes */
+  b.acks = requests / 8;
+  b.frames = requests / 4;
+  b.pauses = requests / 1000;
+
+  b.ring.frames = SKX_HAPTIC_FRAMES;
+  b.haptic.ring = &b.ring;
+  b.out.haptic = &b.haptic;
+
+  /* As skx_start_input() */
+  b.out.hs_state = SKX_HS_ACK;
+  skx_out_queue_init(&b.out, identify_ack, sizeof(identify_ack));
+  out_send(&b);
+
+  start = now_ns();
+
+  pthread_create(&hc, NULL, hc_thread, &b);
+  pthread_create(&ff, NULL, ff_thread, &b);
+  pthread_create(&ack, NULL, ack_thread, &b);
+  pthread_create(&haptic, NULL, haptic_thread, &b);
+  pthread_create(&pause, NULL, pause_thread, &b);
+  pthread_join(ff, NULL);
+  pthread_join(ack, NULL);
+  pthread_join(haptic, NULL);
+  pthread_join(pause, NULL);
+
+  pthread_mutex_lock(&b.lock);
+  b.done = true;
+  pthread_cond_signal(&b.submitted);
+  pthread_mutex_unlock(&b.lock);
+  pthread_join(hc, NULL);
+
+  elapsed = now_ns() - start;
+
+  if (!b.failed && b.acks_sent + b.acks_dropped != b.acks)
+    b.failed = "acks lost";
+  if (!b.failed && requests && b.last_ff != requests)
+    b.failed = "last rumble update lost";
+  if (!b.failed && b.frames_sent != b.frames)
+    b.failed = "haptic frames lost";
+  if (!b.failed && b.frames && (b.haptic.playing || !b.dry))
+    b.failed = "haptic stream never went idle";
+  if (!b.failed && (b.identify_acks != 1 || b.power_ons != 1 || b.hs_waits != 1))
+    b.failed = "handshake out of step";
+  if (!b.failed && skx_out_depth(b.out.queues))
+    b.failed = "packets left queued";
+
+  printf("queue:     %llu queue ops, %llu packets sent (%llu acks, %u dropped, %llu rumble, %llu haptic)\n",
+      (unsigned long long)b.ops, (unsigned long long)b.packets, (unsigned long long)b.acks_sent,
+      b.acks_dropped, (unsigned long long)b.ff_sent, (unsigned long long)b.frames_sent);
+  printf("           %u pauses, haptic stream ran dry %u times\n", b.pauses, b.dry);
+  if (b.ops)
+    printf("           %.1f ns/op, %.0f packets/s\n",
+        (double)elapsed / b.ops, b.packets * 1e9 / elapsed);
+
+  if (b.failed) {
+    printf("queue:     FAILED: %s\n", b.failed);
+    return 1;
+  }
+
+  return 0;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+      "usage: %s [-r capture] [-n passes] [-c curve] [-m] [-f requests] [-p period_us]\n"
+      "          [-s seed] [-q requests]\n"
+      "  -r FILE  replay FILE, raw %d byte IN packets back to back (default: synthetic)\n"
+      "  -n N     replay the reports N times (default 1000)\n"
+      "  -c MODE  shape the sticks with an axial or radial curve (default raw)\n"
+      "  -m       decode through a remap profile (default the pad's own layout)\n"
+      "  -f N     synthetic FF requests to run (default 100000)\n"
+      "  -p US    OUT endpoint interval in microseconds (default 4000)\n"
+      "  -s SEED  seed for the synthetic streams (default 1)\n"
+      "  -q N     only stress the output with N FF updates, N/8 acks and N/4 haptic frames\n",
+      name, PKT_LEN);
+}
+
+int main(int argc, char **argv)
+{
+  const char *capture_path = NULL;
+  const struct skx_stick_curve *curves = NULL;
+  const struct skx_keymap *keymap = NULL;
+  unsigned int passes = 1000, requests = 100000, period_us = 4000, seed = 1;
+  long queue_requests = -1;
+  size_t count;
+  u8 *capture;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "r:n:c:mf:p:s:q:h")) != -1) {
+    switch (opt) {
+      case 'r':
+        capture_path = optarg;
+        break;
+      case 'n':
+        passes = strtoul(optarg, NULL, 0);
+        break;
+      case 'c':
+        curves = bench_curves(optarg);
+        if (!curves) {
+          usage(argv[0]);
+          return EINVAL;
+        }
+        break;
+      case 'm':
+        keymap = bench_keymap();
+        if (!keymap)
+          return EINVAL;
+        break;
+      case 'f':
+        requests = strtoul(optarg, NULL, 0);
+        break;
+      case 'p':
+        period_us = strtoul(optarg, NULL, 0);
+        break;
+      case 's':
+        seed = strtoul(optarg, NULL, 0);
+        break;
+      case 'q':
+        queue_requests = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : EINVAL;
+    }
+  }
+
+  if (!period_us) {
+    usage(argv[0]);
+    return EINVAL;
+  }
+
+  if (queue_requests >= 0)
+    return bench_queue(queue_requests);
+
+  srand(seed);
+
+  capture = capture_path ? load_capture(capture_path, &count) : synth_capture(&count);
+  if (!capture)
+    return EIO;
+
+  bench_reports(capture, count, passes, curves, keymap);
+  bench_conditions(capture, count, period_us);
+  free(capture);
+
+  bench_ff(requests, period_us);
+
+  return 0;
+}
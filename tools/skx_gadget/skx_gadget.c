@@ -0,0 +1,842 @@
+/*
+  Impersonates an Xbox One S pad through raw-gadget, so the driver can be
+  exercised end to end on a machine with no pad, normally over dummy_hcd:
+
+    modprobe dummy_hcd
+    modprobe raw_gadget
+    ./skx_gadget -r 250 -d 10
+
+  The gadget answers the driver's init handshake, acks anything sent with
+  the ack bit, and once the pad has been powered on streams 0x20 reports
+  at the given rate. Each report carries a sequence number in the left
+  trigger, which has no fuzz, so it can be matched against the events
+  read back from the pad's evdev node. The FF round trip is timed from
+  writing an FF_RUMBLE play or stop to evdev to the rumble packet that
+  results arriving on the OUT endpoint.
+
+  Latencies are printed as p50/p99/max:
+    input  - report handed to the UDC until read() returns it from evdev,
+             including the wait for the host to poll the IN endpoint
+    evdev  - the same, but to the timestamp of the event, which the driver
+             takes from the input URB's completion less in_delay_us
+    ff     - EV_FF written to evdev until the rumble packet is received
+
+  Frames lost between the gadget and evdev are counted from gaps in the
+  MSC_SERIAL the driver sends with every frame, the GIP sequence byte.
+
+  With -R /dev/skxraw<n> the pad's raw report ring is mapped as well:
+    urb    - report handed to the UDC until the driver's input URB completed
+    raw    - the same, until poll() on the raw device woke us up with it
+
+  With -H as well, the raw device's haptic ring is kept full of frames
+  counting 1..100 on the left trigger motor:
+    hap    - gap between two stream frames arriving on the OUT endpoint,
+             which should be the OUT interval unless FF packets got in
+             between; frames that arrive out of order or not at all are
+             counted as skipped
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/input.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#include "../../skx_raw.h"
+
+#define VENDOR_ID 0x045e
+#define PRODUCT_ID 0x02ea
+#define PKT_LEN 64
+#define EP0_MAX 64
+#define SEQ_VALUES 1023       /* left trigger values used as sequence numbers */
+#define MAX_SAMPLES 1000000
+
+struct raw_ep_io {
+  struct usb_raw_ep_io inner;
+  uint8_t data[EP0_MAX > PKT_LEN ? EP0_MAX : PKT_LEN];
+};
+
+struct raw_control_event {
+  struct usb_raw_event inner;
+  struct usb_ctrlrequest ctrl;
+};
+
+struct samples {
+  uint64_t *ns;
+  size_t count;
+};
+
+static int raw_fd;
+static int ep_in = -1, ep_out = -1;
+static pthread_mutex_t ep_in_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int rate = 250;
+static unsigned int duration = 10;
+static unsigned int ff_interval_ms = 20;
+static const char *udc_driver = "dummy_udc";
+static const char *udc_device = "dummy_udc.0";
+static const char *raw_path;
+static bool haptic;
+
+static atomic_bool powered;
+static atomic_bool stopping;
+static uint8_t out_seq;
+
+/* Time each trigger value was handed to the UDC */
+static _Atomic uint64_t report_sent[SEQ_VALUES + 1];
+
+/* FF round trip: the request in flight and the motor state it expects */
+static _Atomic uint64_t ff_sent;
+static atomic_int ff_expect = -1;   /* 1 running, 0 stopped */
+
+static struct samples input_lat, evdev_lat, ff_lat, urb_lat, raw_lat, hap_gap;
+static unsigned long frames_lost, hap_skipped;
+static pthread_mutex_t samples_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct usb_device_descriptor device_desc = {
+  .bLength = USB_DT_DEVICE_SIZE,
+  .bDescriptorType = USB_DT_DEVICE,
+  .bcdUSB = __constant_cpu_to_le16(0x0200),
+  .bDeviceClass = 0xFF,
+  .bDeviceSubClass = 0xFF,
+  .bDeviceProtocol = 0xFF,
+  .bMaxPacketSize0 = EP0_MAX,
+  .idVendor = __constant_cpu_to_le16(VENDOR_ID),
+  .idProduct = __constant_cpu_to_le16(PRODUCT_ID),
+  .bcdDevice = __constant_cpu_to_le16(0x0408),
+  .bNumConfigurations = 1,
+};
+
+static struct usb_config_descriptor config_desc = {
+  .bLength = USB_DT_CONFIG_SIZE,
+  .bDescriptorType = USB_DT_CONFIG,
+  .bNumInterfaces = 1,
+  .bConfigurationValue = 1,
+  .bmAttributes = USB_CONFIG_ATT_ONE,
+  .bMaxPower = 250,
+};
+
+static struct usb_interface_descriptor interface_desc = {
+  .bLength = USB_DT_INTERFACE_SIZE,
+  .bDescriptorType = USB_DT_INTERFACE,
+  .bInterfaceNumber = 0,
+  .bNumEndpoints = 2,
+  .bInterfaceClass = USB_CLASS_VENDOR_SPEC,
+  .bInterfaceSubClass = 71,
+  .bInterfaceProtocol = 208,
+};
+
+/* The driver expects the OUT endpoint first, like the real pad */
+static struct usb_endpoint_descriptor out_desc = {
+  .bLength = USB_DT_ENDPOINT_SIZE,
+  .bDescriptorType = USB_DT_ENDPOINT,
+  .bEndpointAddress = USB_DIR_OUT | 1,
+  .bmAttributes = USB_ENDPOINT_XFER_INT,
+  .wMaxPacketSize = __constant_cpu_to_le16(PKT_LEN),
+  .bInterval = 4,
+};
+
+static struct usb_endpoint_descriptor in_desc = {
+  .bLength = USB_DT_ENDPOINT_SIZE,
+  .bDescriptorType = USB_DT_ENDPOINT,
+  .bEndpointAddress = USB_DIR_IN | 2,
+  .bmAttributes = USB_ENDPOINT_XFER_INT,
+  .wMaxPacketSize = __constant_cpu_to_le16(PKT_LEN),
+  .bInterval = 4,
+};
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void die(const char *what)
+{
+  perror(what);
+  exit(EXIT_FAILURE);
+}
+
+static void sample_add(struct samples *s, uint64_t ns)
+{
+  pthread_mutex_lock(&samples_lock);
+  if (s->count < MAX_SAMPLES)
+    s->ns[s->count++] = ns;
+  pthread_mutex_unlock(&samples_lock);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void sample_print(const char *name, struct samples *s)
+{
+  if (!s->count) {
+    printf("%-6s no samples\n", name);
+    return;
+  }
+
+  qsort(s->ns, s->count, sizeof(*s->ns), cmp_u64);
+  printf("%-6s %7zu samples  p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", name, s->count,
+      s->ns[s->count / 2] / 1e3, s->ns[s->count * 99 / 100] / 1e3, s->ns[s->count - 1] / 1e3);
+}
+
+/* raw-gadget plumbing */
+
+static int ep_write(int ep, const uint8_t *data, size_t len)
+{
+  struct raw_ep_io io;
+  int ret;
+
+  io.inner.ep = ep;
+  io.inner.flags = 0;
+  io.inner.length = len;
+  memcpy(io.data, data, len);
+
+  pthread_mutex_lock(&ep_in_lock);
+  ret = ioctl(raw_fd, USB_RAW_IOCTL_EP_WRITE, &io);
+  pthread_mutex_unlock(&ep_in_lock);
+
+  return ret;
+}
+
+static int ep_read(int ep, uint8_t *data)
+{
+  struct raw_ep_io io;
+  int ret;
+
+  io.inner.ep = ep;
+  io.inner.flags = 0;
+  io.inner.length = PKT_LEN;
+
+  ret = ioctl(raw_fd, USB_RAW_IOCTL_EP_READ, &io);
+  if (ret > 0)
+    memcpy(data, io.data, ret);
+
+  return ret;
+}
+
+/* Picks UDC endpoints able to carry our two interrupt endpoints */
+static void assign_endpoints(void)
+{
+  struct usb_raw_eps_info info;
+  struct usb_raw_ep_info *ep;
+  bool have_in = false, have_out = false;
+  int i, num;
+
+  memset(&info, 0, sizeof(info));
+  num = ioctl(raw_fd, USB_RAW_IOCTL_EPS_INFO, &info);
+  if (num < 0)
+    die("USB_RAW_IOCTL_EPS_INFO");
+
+  for (i = 0; i < num; i++) {
+    ep = &info.eps[i];
+    if (!ep->caps.type_int)
+      continue;
+
+    if (!have_out && ep->caps.dir_out) {
+      if (ep->addr != USB_RAW_EP_ADDR_ANY)
+        out_desc.bEndpointAddress = USB_DIR_OUT | ep->addr;
+      have_out = true;
+    } else if (!have_in && ep->caps.dir_in) {
+      if (ep->addr != USB_RAW_EP_ADDR_ANY)
+        in_desc.bEndpointAddress = USB_DIR_IN | ep->addr;
+      have_in = true;
+    }
+  }
+
+  if (!have_in || !have_out) {
+    fprintf(stderr, "%s has no free interrupt endpoints\n", udc_device);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static size_t build_config(uint8_t *buf, size_t max)
+{
+  size_t len = 0;
+
+#define APPEND(desc) do { \
+    memcpy(buf + len, &(desc), (desc).bLength); \
+    len += (desc).bLength; \
+  } while (0)
+
+  APPEND(config_desc);
+  APPEND(interface_desc);
+  APPEND(out_desc);
+  APPEND(in_desc);
+
+#undef APPEND
+
+  ((struct usb_config_descriptor *)buf)->wTotalLength = __cpu_to_le16(len);
+
+  return len < max ? len : max;
+}
+
+/* GIP, the pad side */
+
+static void send_ack(const uint8_t *pkt)
+{
+  uint8_t ack[13] = {
+    0x01, 0x20, pkt[2], 0x09, 0x00,
+    pkt[0], 0x20, pkt[3], 0x00, 0x00,
+    0x00, 0x00, 0x00
+  };
+
+  ep_write(ep_in, ack, sizeof(ack));
+}
+
+/* A haptic stream frame arrived, see haptic_thread() */
+static void hap_frame(uint8_t value)
+{
+  static uint64_t last_at;
+  static uint8_t last;
+  uint64_t now = now_ns();
+
+  if (last) {
+    if (value != last % 100 + 1)
+      hap_skipped++;
+    sample_add(&hap_gap, now - last_at);
+  }
+
+  last = value;
+  last_at = now;
+}
+
+static void *out_thread(void *arg)
+{
+  uint8_t pkt[PKT_LEN];
+  uint64_t sent;
+  int len, expect;
+  bool running;
+
+  while (!atomic_load(&stopping)) {
+    len = ep_read(ep_out, pkt);
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (len < 4)
+      continue;
+
+    if (pkt[1] & 0x10)
+      send_ack(pkt);
+
+    switch (pkt[0]) {
+      case 0x05:
+        /* Power on */
+        if (len >= 5 && pkt[4] == 0x00 && !atomic_exchange(&powered, true))
+          printf("pad powered on by the host\n");
+        break;
+
+      case 0x09:
+        if (len < 10)
+          break;
+        if (pkt[6]) {
+          hap_frame(pkt[6]);
+          break;
+        }
+        running = pkt[8] || pkt[9];
+        expect = atomic_load(&ff_expect);
+        sent = atomic_load(&ff_sent);
+        if (expect >= 0 && running == expect &&
+            atomic_compare_exchange_strong(&ff_expect, &expect, -1))
+          sample_add(&ff_lat, now_ns() - sent);
+        break;
+    }
+  }
+
+  return NULL;
+}
+
+static void *in_thread(void *arg)
+{
+  uint8_t report[PKT_LEN] = { 0x20, 0x00, 0x00, 0x0E };
+  uint64_t period = 1000000000ULL / rate, next, end;
+  struct timespec ts;
+  unsigned int n = 0, value;
+
+  end = now_ns() + duration * 1000000000ULL;
+  next = now_ns();
+
+  while (!atomic_load(&stopping) && next < end) {
+    value = 1 + n++ % SEQ_VALUES;
+
+    report[2] = out_seq++;
+    report[6] = value & 0xFF;
+    report[7] = value >> 8;
+
+    atomic_store(&report_sent[value], now_ns());
+    if (ep_write(ep_in, report, 18) < 0 && errno != EINTR)
+      break;
+
+    next += period;
+    ts.tv_sec = next / 1000000000ULL;
+    ts.tv_nsec = next % 1000000000ULL;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+  }
+
+  atomic_store(&stopping, true);
+
+  return NULL;
+}
+
+/* The host side: evdev */
+
+static int open_evdev(void)
+{
+  char path[300];
+  struct input_id id;
+  struct dirent *de;
+  DIR *dir;
+  int fd, tries;
+
+  for (tries = 0; tries < 100; tries++) {
+    dir = opendir("/dev/input");
+    if (!dir)
+      die("/dev/input");
+
+    while ((de = readdir(dir))) {
+      if (strncmp(de->d_name, "event", 5))
+        continue;
+
+      snprintf(path, sizeof(path), "/dev/input/%s", de->d_name);
+      fd = open(path, O_RDWR);
+      if (fd < 0)
+        continue;
+
+      if (!ioctl(fd, EVIOCGID, &id) && id.vendor == VENDOR_ID && id.product == PRODUCT_ID) {
+        closedir(dir);
+        printf("pad bound as %s\n", path);
+        return fd;
+      }
+      close(fd);
+    }
+
+    closedir(dir);
+    usleep(50000);
+  }
+
+  fprintf(stderr, "the driver did not bind to the gadget, is skx loaded?\n");
+  exit(EXIT_FAILURE);
+}
+
+static void *evdev_thread(void *arg)
+{
+  int fd = *(int *)arg;
+  struct input_event ev;
+  uint64_t stamp = 0, read_at;
+  int value = 0, serial = -1;
+
+  while (!atomic_load(&stopping)) {
+    if (read(fd, &ev, sizeof(ev)) != sizeof(ev)) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    read_at = now_ns();
+
+    if (ev.type == EV_MSC && ev.code == MSC_SERIAL) {
+      if (serial >= 0)
+        frames_lost += (uint8_t)(ev.value - serial - 1);
+      serial = ev.value & 0xFF;
+    } else if (ev.type == EV_ABS && ev.code == ABS_Z) {
+      value = ev.value;
+      stamp = ev.input_event_sec * 1000000000ULL + ev.input_event_usec * 1000ULL;
+    } else if (ev.type == EV_SYN && ev.code == SYN_REPORT && value > 0 && value <= SEQ_VALUES) {
+      uint64_t sent = atomic_load(&report_sent[value]);
+
+      if (sent) {
+        sample_add(&input_lat, read_at - sent);
+        if (stamp > sent)
+          sample_add(&evdev_lat, stamp - sent);
+      }
+      value = 0;
+    }
+  }
+
+  return NULL;
+}
+
+/* The host side: the driver's raw report ring */
+
+static void raw_sample(const struct skx_raw_slot *slot, uint64_t woke)
+{
+  unsigned int value = slot->data[6] | slot->data[7] << 8;
+  uint64_t sent;
+
+  if (slot->data[0] != 0x20 || !value || value > SEQ_VALUES)
+    return;
+
+  sent = atomic_load(&report_sent[value]);
+  if (!sent)
+    return;
+
+  if (slot->timestamp > sent)
+    sample_add(&urb_lat, slot->timestamp - sent);
+  sample_add(&raw_lat, woke - sent);
+}
+
+static void *raw_thread(void *arg)
+{
+  const volatile struct skx_raw_ring *ring;
+  struct skx_raw_slot slot;
+  struct pollfd pfd;
+  uint32_t tail, head;
+  uint64_t woke;
+  long page = sysconf(_SC_PAGESIZE);
+  size_t size = (sizeof(*ring) + page - 1) / page * page;
+
+  pfd.fd = open(raw_path, O_RDONLY);
+  if (pfd.fd < 0)
+    die(raw_path);
+  pfd.events = POLLIN;
+
+  ring = mmap(NULL, size, PROT_READ, MAP_SHARED, pfd.fd, 0);
+  if (ring == MAP_FAILED)
+    die("mmap");
+
+  tail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+  while (!atomic_load(&stopping)) {
+    if (poll(&pfd, 1, 100) <= 0 || (pfd.revents & POLLHUP))
+      continue;
+    woke = now_ns();
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head - tail > SKX_RAW_SLOTS)
+      tail = head - SKX_RAW_SLOTS;
+
+    for (; tail != head; tail++) {
+      memcpy(&slot, (const void *)&ring->slot[tail % SKX_RAW_SLOTS], sizeof(slot));
+      raw_sample(&slot, woke);
+    }
+  }
+
+  return NULL;
+}
+
+/*
+  Keeps the haptic ring topped up and kicks it once per refill, in case
+  FF packets or a late wakeup let it run dry.
+*/
+static void *haptic_thread(void *arg)
+{
+  volatile struct skx_haptic_ring *ring;
+  struct pollfd pfd;
+  uint32_t head, n = 0;
+  long page = sysconf(_SC_PAGESIZE);
+  size_t size = (sizeof(*ring) + page - 1) / page * page;
+
+  pfd.fd = open(raw_path, O_RDWR);
+  if (pfd.fd < 0)
+    die(raw_path);
+  pfd.events = POLLOUT;
+
+  ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, pfd.fd, SKX_HAPTIC_OFFSET);
+  if (ring == MAP_FAILED)
+    die("mmap");
+
+  head = ring->head;
+
+  while (!atomic_load(&stopping)) {
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) < SKX_HAPTIC_FRAMES) {
+      memset((void *)&ring->frame[head % SKX_HAPTIC_FRAMES], 0, sizeof(struct skx_haptic_frame));
+      ring->frame[head % SKX_HAPTIC_FRAMES].motors[0] = 1 + n++ % 100;
+      __atomic_store_n(&ring->head, ++head, __ATOMIC_RELEASE);
+    }
+
+    if (write(pfd.fd, "", 1) < 0)
+      die("write");
+
+    if (poll(&pfd, 1, 100) > 0 && (pfd.revents & POLLHUP))
+      break;
+  }
+
+  return NULL;
+}
+
+static void *ff_thread(void *arg)
+{
+  int fd = *(int *)arg;
+  struct ff_effect effect;
+  struct input_event play;
+  int on = 1;
+
+  memset(&effect, 0, sizeof(effect));
+  effect.type = FF_RUMBLE;
+  effect.id = -1;
+  effect.u.rumble.strong_magnitude = 0xFFFF;
+  effect.u.rumble.weak_magnitude = 0xFFFF;
+
+  if (ioctl(fd, EVIOCSFF, &effect) < 0) {
+    perror("EVIOCSFF");
+    return NULL;
+  }
+
+  memset(&play, 0, sizeof(play));
+  play.type = EV_FF;
+  play.code = effect.id;
+
+  while (!atomic_load(&stopping)) {
+    usleep(ff_interval_ms * 1000);
+
+    /* A request that never produced a packet is not counted */
+    atomic_store(&ff_expect, -1);
+
+    play.value = on;
+    atomic_store(&ff_sent, now_ns());
+    atomic_store(&ff_expect, on);
+    if (write(fd, &play, sizeof(play)) != sizeof(play))
+      break;
+
+    on = !on;
+  }
+
+  return NULL;
+}
+
+static void *pad_thread(void *arg)
+{
+  static int evdev_fd;
+  pthread_t out, in, evdev, ff, raw, hap;
+  int clk = CLOCK_MONOTONIC;
+
+  evdev_fd = open_evdev();
+  if (ioctl(evdev_fd, EVIOCSCLOCKID, &clk) < 0)
+    die("EVIOCSCLOCKID");
+
+  pthread_create(&out, NULL, out_thread, NULL);
+  pthread_create(&evdev, NULL, evdev_thread, &evdev_fd);
+  if (raw_path)
+    pthread_create(&raw, NULL, raw_thread, NULL);
+
+  /* Reports only make sense once the driver powered the pad on */
+  while (!atomic_load(&powered))
+    usleep(1000);
+
+  pthread_create(&ff, NULL, ff_thread, &evdev_fd);
+  if (haptic)
+    pthread_create(&hap, NULL, haptic_thread, NULL);
+  pthread_create(&in, NULL, in_thread, NULL);
+  pthread_join(in, NULL);
+
+  sample_print("input", &input_lat);
+  sample_print("evdev", &evdev_lat);
+  sample_print("ff", &ff_lat);
+  printf("lost   %lu frames\n", frames_lost);
+  if (raw_path) {
+    sample_print("urb", &urb_lat);
+    sample_print("raw", &raw_lat);
+  }
+  if (haptic) {
+    sample_print("hap", &hap_gap);
+    printf("hap    %lu frames skipped\n", hap_skipped);
+  }
+
+  exit(EXIT_SUCCESS);
+  return NULL;
+}
+
+/* ep0 */
+
+static void ep0_stall(void)
+{
+  if (ioctl(raw_fd, USB_RAW_IOCTL_EP0_STALL, 0) < 0)
+    perror("USB_RAW_IOCTL_EP0_STALL");
+}
+
+static void ep0_reply(const void *data, size_t len)
+{
+  struct raw_ep_io io;
+
+  io.inner.ep = 0;
+  io.inner.flags = 0;
+  io.inner.length = len;
+  memcpy(io.data, data, len);
+
+  if (ioctl(raw_fd, USB_RAW_IOCTL_EP0_WRITE, &io) < 0)
+    perror("USB_RAW_IOCTL_EP0_WRITE");
+}
+
+static void ep0_ack(void)
+{
+  struct raw_ep_io io;
+
+  io.inner.ep = 0;
+  io.inner.flags = 0;
+  io.inner.length = 0;
+
+  if (ioctl(raw_fd, USB_RAW_IOCTL_EP0_READ, &io) < 0)
+    perror("USB_RAW_IOCTL_EP0_READ");
+}
+
+static void set_configuration(void)
+{
+  pthread_t pad;
+
+  ep_out = ioctl(raw_fd, USB_RAW_IOCTL_EP_ENABLE, &out_desc);
+  if (ep_out < 0)
+    die("USB_RAW_IOCTL_EP_ENABLE (out)");
+  ep_in = ioctl(raw_fd, USB_RAW_IOCTL_EP_ENABLE, &in_desc);
+  if (ep_in < 0)
+    die("USB_RAW_IOCTL_EP_ENABLE (in)");
+
+  if (ioctl(raw_fd, USB_RAW_IOCTL_VBUS_DRAW, config_desc.bMaxPower) < 0)
+    die("USB_RAW_IOCTL_VBUS_DRAW");
+  if (ioctl(raw_fd, USB_RAW_IOCTL_CONFIGURE, 0) < 0)
+    die("USB_RAW_IOCTL_CONFIGURE");
+
+  ep0_ack();
+
+  pthread_create(&pad, NULL, pad_thread, NULL);
+  pthread_detach(pad);
+}
+
+static void handle_control(const struct usb_ctrlrequest *ctrl)
+{
+  uint8_t buf[EP0_MAX * 4];
+  size_t len = __le16_to_cpu(ctrl->wLength);
+
+  if ((ctrl->bRequestType & USB_TYPE_MASK) != USB_TYPE_STANDARD) {
+    ep0_stall();
+    return;
+  }
+
+  switch (ctrl->bRequest) {
+    case USB_REQ_GET_DESCRIPTOR:
+      switch (__le16_to_cpu(ctrl->wValue) >> 8) {
+        case USB_DT_DEVICE:
+          ep0_reply(&device_desc, len < sizeof(device_desc) ? len : sizeof(device_desc));
+          return;
+        case USB_DT_CONFIG:
+          ep0_reply(buf, build_config(buf, len < EP0_MAX ? len : EP0_MAX));
+          return;
+      }
+      break;
+
+    case USB_REQ_SET_CONFIGURATION:
+      set_configuration();
+      return;
+
+    case USB_REQ_SET_INTERFACE:
+      ep0_ack();
+      return;
+  }
+
+  ep0_stall();
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+      "usage: %s [-r rate] [-d seconds] [-f ms] [-u driver] [-D device] [-R rawdev] [-H]\n"
+      "  -r HZ    input reports per second (default 250)\n"
+      "  -d S     how long to stream reports (default 10)\n"
+      "  -f MS    time between FF play/stop requests (default 20)\n"
+      "  -u NAME  UDC driver (default dummy_udc)\n"
+      "  -D NAME  UDC device (default dummy_udc.0)\n"
+      "  -R PATH  also time reports through the driver's raw device\n"
+      "  -H       stream haptic frames through the raw device as well\n",
+      name);
+}
+
+int main(int argc, char **argv)
+{
+  struct usb_raw_init init;
+  struct raw_control_event event;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "r:d:f:u:D:R:Hh")) != -1) {
+    switch (opt) {
+      case 'r':
+        rate = strtoul(optarg, NULL, 0);
+        break;
+      case 'd':
+        duration = strtoul(optarg, NULL, 0);
+        break;
+      case 'f':
+        ff_interval_ms = strtoul(optarg, NULL, 0);
+        break;
+      case 'u':
+        udc_driver = optarg;
+        break;
+      case 'D':
+        udc_device = optarg;
+        break;
+      case 'R':
+        raw_path = optarg;
+        break;
+      case 'H':
+        haptic = true;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : EINVAL;
+    }
+  }
+
+  if (!rate || !ff_interval_ms || (haptic && !raw_path)) {
+    usage(argv[0]);
+    return EINVAL;
+  }
+
+  input_lat.ns = calloc(MAX_SAMPLES, sizeof(uint64_t));
+  evdev_lat.ns = calloc(MAX_SAMPLES, sizeof(uint64_t));
+  ff_lat.ns = calloc(MAX_SAMPLES, sizeof(uint64_t));
+  urb_lat.ns = calloc(MAX_SAMPLES, sizeof(uint64_t));
+  raw_lat.ns = calloc(MAX_SAMPLES, sizeof(uint64_t));
+  hap_gap.ns = calloc(MAX_SAMPLES, sizeof(uint64_t));
+
+  raw_fd = open("/dev/raw-gadget", O_RDWR);
+  if (raw_fd < 0)
+    die("/dev/raw-gadget");
+
+  memset(&init, 0, sizeof(init));
+  strncpy((char *)init.driver_name, udc_driver, UDC_NAME_LENGTH_MAX - 1);
+  strncpy((char *)init.device_name, udc_device, UDC_NAME_LENGTH_MAX - 1);
+  init.speed = USB_SPEED_FULL;
+
+  if (ioctl(raw_fd, USB_RAW_IOCTL_INIT, &init) < 0)
+    die("USB_RAW_IOCTL_INIT");
+  if (ioctl(raw_fd, USB_RAW_IOCTL_RUN, 0) < 0)
+    die("USB_RAW_IOCTL_RUN");
+
+  for (;;) {
+    event.inner.type = 0;
+    event.inner.length = sizeof(event.ctrl);
+
+    if (ioctl(raw_fd, USB_RAW_IOCTL_EVENT_FETCH, &event) < 0)
+      die("USB_RAW_IOCTL_EVENT_FETCH");
+
+    switch (event.inner.type) {
+      case USB_RAW_EVENT_CONNECT:
+        assign_endpoints();
+        break;
+      case USB_RAW_EVENT_CONTROL:
+        handle_control(&event.ctrl);
+        break;
+    }
+  }
+
+  return 0;
+}
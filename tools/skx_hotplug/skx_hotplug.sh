@@ -0,0 +1,131 @@
+#!/bin/sh
+#
+# Unbinds and rebinds a pad from skx over and over, the way a kiosk that
+# has pads plugged in and out all day would, and checks that every bind
+# gets the pad reporting again and that nothing is left behind:
+#
+#   sudo tools/skx_hotplug/skx_hotplug.sh -n 5000
+#
+# Works on a real pad (hold a stick off-centre so it keeps reporting) or
+# on tools/skx_gadget with a long enough -d. Each cycle waits for the
+# driver's first_report_us, the time from probe to the first input
+# report, which is summarised at the end. Fails if a bind never got that
+# far, if the raw or input devices pile up, or if kmemleak (when enabled)
+# finds objects allocated by skx.
+
+DRIVER=/sys/bus/usb/drivers/skx
+CYCLES=1000
+TIMEOUT_MS=2000
+KMEMLEAK=/sys/kernel/debug/kmemleak
+
+usage() {
+  echo "usage: $0 [-n cycles] [-t timeout_ms] [interface]" >&2
+  exit 1
+}
+
+while getopts n:t:h opt; do
+  case $opt in
+    n) CYCLES=$OPTARG ;;
+    t) TIMEOUT_MS=$OPTARG ;;
+    *) usage ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+INTF=$1
+if [ -z "$INTF" ]; then
+  for dev in "$DRIVER"/*:*; do
+    [ -e "$dev" ] && INTF=$(basename "$dev") && break
+  done
+fi
+if [ -z "$INTF" ] || [ ! -e "$DRIVER/$INTF" ]; then
+  echo "no pad bound to skx" >&2
+  exit 1
+fi
+
+meminfo() {
+  awk -v key="$1:" '$1 == key { print $2 }' /proc/meminfo
+}
+
+count() {
+  ls -d $1 2>/dev/null | wc -l
+}
+
+# Waits for the freshly bound pad to report, prints first_report_us or nothing
+wait_report() {
+  waited=0
+  while [ $waited -lt "$TIMEOUT_MS" ]; do
+    us=$(cat "$DRIVER/$INTF/first_report_us" 2>/dev/null)
+    if [ -n "$us" ] && [ "$us" != 0 ]; then
+      echo "$us"
+      return
+    fi
+    sleep 0.005
+    waited=$((waited + 5))
+  done
+}
+
+[ -w "$KMEMLEAK" ] && echo clear > "$KMEMLEAK"
+
+raw_before=$(count '/sys/class/misc/skxraw*')
+input_before=$(count '/sys/class/input/input*')
+slab_before=$(meminfo Slab)
+percpu_before=$(meminfo Percpu)
+vmalloc_before=$(meminfo VmallocUsed)
+
+samples=$(mktemp)
+trap 'rm -f "$samples"' EXIT
+stalls=0
+i=0
+
+while [ $i -lt "$CYCLES" ]; do
+  echo "$INTF" > "$DRIVER/unbind"
+  echo "$INTF" > "$DRIVER/bind"
+
+  us=$(wait_report)
+  if [ -n "$us" ]; then
+    echo "$us" >> "$samples"
+  else
+    stalls=$((stalls + 1))
+    echo "cycle $i: no report within $TIMEOUT_MS ms" >&2
+  fi
+
+  i=$((i + 1))
+done
+
+# Let deferred frees (RCU, workqueues) settle before comparing
+sleep 1
+
+status=0
+
+sort -n "$samples" | awk -v stalls=$stalls '
+  { v[NR] = $1 }
+  END {
+    printf "%d binds, %d stalled\n", NR + stalls, stalls
+    if (NR)
+      printf "first report  p50 %d us  p99 %d us  max %d us\n",
+          v[int((NR - 1) / 2) + 1], v[int((NR - 1) * 99 / 100) + 1], v[NR]
+  }'
+[ $stalls -eq 0 ] || status=1
+
+printf "slab %+d kB  percpu %+d kB  vmalloc %+d kB\n" \
+  $(($(meminfo Slab) - slab_before)) \
+  $(($(meminfo Percpu) - percpu_before)) \
+  $(($(meminfo VmallocUsed) - vmalloc_before))
+
+if [ "$(count '/sys/class/misc/skxraw*')" -ne "$raw_before" ] ||
+   [ "$(count '/sys/class/input/input*')" -ne "$input_before" ]; then
+  echo "raw or input devices left behind" >&2
+  status=1
+fi
+
+if [ -w "$KMEMLEAK" ]; then
+  echo scan > "$KMEMLEAK"
+  leaks=$(awk '/^unreferenced object/ { n += hit; hit = 0 } /skx/ { hit = 1 } END { print n + hit }' "$KMEMLEAK")
+  echo "kmemleak: $leaks suspected leaks in skx"
+  [ "$leaks" -eq 0 ] || status=1
+else
+  echo "kmemleak not available, only the meminfo deltas above to go by"
+fi
+
+exit $status